@@ -19,20 +19,25 @@ class aabb
     point3 min() const { return minimum; }
     point3 max() const { return maximum; }
 
+    point3 centroid() const { return 0.5f * (minimum + maximum); }
+
+    float surface_area() const
+    {
+        vec3 d = maximum - minimum;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
     inline bool hit(const ray& r, float t_min, float t_max) const
     {
+        // the slab faces the ray enters and leaves through follow from the sign of the direction on each axis
         for (int a = 0; a < 3; a++) {
-            auto invD = 1.0f / r.direction()[a];
-            auto t0 = (min()[a] - r.origin()[a]) * invD;
-            auto t1 = (max()[a] - r.origin()[a]) * invD;
-            if (invD < 0.0f)
-                std::swap(t0, t1);
+            bool negative = (r.sign_mask() >> a) & 1;
+            auto t0 = ((negative ? maximum[a] : minimum[a]) - r.orig[a]) * r.inv_dir[a];
+            auto t1 = ((negative ? minimum[a] : maximum[a]) - r.orig[a]) * r.inv_dir[a];
             t_min = t0 > t_min ? t0 : t_min;
             t_max = t1 < t_max ? t1 : t_max;
-            if (t_max <= t_min)
-                return false;
         }
-        return true;
+        return t_min < t_max;
     }
 
     point3 minimum;
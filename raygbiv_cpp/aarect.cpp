@@ -1,61 +1,243 @@
 #include "aarect.h"
 
+#include "ray_packet.h"
+
+namespace {
+
+// The lanes of the packet whose rays cross the plane where k is at their k coordinate inside [a0, a1] x [b0, b1], with
+// the distances in t and the crossings in a and b; the same operations as the intersect_t of the rects, a SIMD group
+// of lanes at a time.
+uint32_t
+packet_rect_test(const ray_packet& packet,
+                 uint32_t lanes,
+                 const float* origin_k,
+                 const float* direction_k,
+                 const float* origin_a,
+                 const float* direction_a,
+                 const float* origin_b,
+                 const float* direction_b,
+                 float k,
+                 float a0,
+                 float a1,
+                 float b0,
+                 float b1,
+                 float* t,
+                 float* a,
+                 float* b)
+{
+    const simd_float plane = simd_set(k);
+    const simd_float t_min = simd_set(packet.t_min);
+    const simd_float lo_a = simd_set(a0), hi_a = simd_set(a1);
+    const simd_float lo_b = simd_set(b0), hi_b = simd_set(b1);
+    uint32_t hits = 0;
+    for (int first = 0; first < ray_packet::max_width && (lanes >> first) != 0; first += simd_float::width) {
+        uint32_t group = (lanes >> first) & ((1u << simd_float::width) - 1);
+        if (group == 0)
+            continue;
+        simd_float plane_t = (plane - simd_load(origin_k + first)) / simd_load(direction_k + first);
+        simd_float at_a = simd_load(origin_a + first) + plane_t * simd_load(direction_a + first);
+        simd_float at_b = simd_load(origin_b + first) + plane_t * simd_load(direction_b + first);
+        simd_float hit = (plane_t >= t_min) & (plane_t <= simd_load(packet.t_max + first)) & (at_a >= lo_a) &
+                         (at_a <= hi_a) & (at_b >= lo_b) & (at_b <= hi_b);
+
+        uint32_t group_hits = static_cast<uint32_t>(simd_bits(hit)) & group;
+        if (group_hits != 0) {
+            simd_store(t + first, plane_t);
+            simd_store(a + first, at_a);
+            simd_store(b + first, at_b);
+            hits |= group_hits << first;
+        }
+    }
+    return hits;
+}
+
+} // namespace
+
+bool
+xy_rect::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    auto plane_t = (k - r.origin().z) / r.direction().z;
+    if (plane_t < t_min || plane_t > t_max)
+        return false;
+    auto x = r.origin().x + plane_t * r.direction().x;
+    auto y = r.origin().y + plane_t * r.direction().y;
+    if (x < x0 || x > x1 || y < y0 || y > y1)
+        return false;
+    t = plane_t;
+    return true;
+}
+
+void
+xy_rect::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    alignas(64) float t[ray_packet::max_width];
+    alignas(64) float a[ray_packet::max_width];
+    alignas(64) float b[ray_packet::max_width];
+    uint32_t hits = packet_rect_test(packet,
+                                     lanes,
+                                     packet.origin_z,
+                                     packet.direction_z,
+                                     packet.origin_x,
+                                     packet.direction_x,
+                                     packet.origin_y,
+                                     packet.direction_y,
+                                     k,
+                                     x0,
+                                     x1,
+                                     y0,
+                                     y1,
+                                     t,
+                                     a,
+                                     b);
+    packet.record_deferred(hits, t, this, a, b);
+}
+
 bool
 xy_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-    auto t = (k - r.origin().z) / r.direction().z;
-    if (t < t_min || t > t_max)
+    float t;
+    if (!xy_rect::intersect_t(r, t_min, t_max, t))
         return false;
     auto x = r.origin().x + t * r.direction().x;
     auto y = r.origin().y + t * r.direction().y;
-    if (x < x0 || x > x1 || y < y0 || y > y1)
-        return false;
+    xy_rect::fill_hit(r, t, x, y, rec);
+    return true;
+}
+
+void
+xy_rect::fill_hit(const ray& r, float t, float x, float y, hit_record& rec) const
+{
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (y - y0) / (y1 - y0);
     rec.t = t;
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    rec.mat_id = mat_id;
     rec.p = r.at(t);
+}
+
+bool
+xz_rect::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    auto plane_t = (k - r.origin().y) / r.direction().y;
+    if (plane_t < t_min || plane_t > t_max)
+        return false;
+    auto x = r.origin().x + plane_t * r.direction().x;
+    auto z = r.origin().z + plane_t * r.direction().z;
+    if (x < x0 || x > x1 || z < z0 || z > z1)
+        return false;
+    t = plane_t;
     return true;
 }
 
+void
+xz_rect::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    alignas(64) float t[ray_packet::max_width];
+    alignas(64) float a[ray_packet::max_width];
+    alignas(64) float b[ray_packet::max_width];
+    uint32_t hits = packet_rect_test(packet,
+                                     lanes,
+                                     packet.origin_y,
+                                     packet.direction_y,
+                                     packet.origin_x,
+                                     packet.direction_x,
+                                     packet.origin_z,
+                                     packet.direction_z,
+                                     k,
+                                     x0,
+                                     x1,
+                                     z0,
+                                     z1,
+                                     t,
+                                     a,
+                                     b);
+    packet.record_deferred(hits, t, this, a, b);
+}
+
 bool
 xz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-    auto t = (k - r.origin().y) / r.direction().y;
-    if (t < t_min || t > t_max)
+    float t;
+    if (!xz_rect::intersect_t(r, t_min, t_max, t))
         return false;
     auto x = r.origin().x + t * r.direction().x;
     auto z = r.origin().z + t * r.direction().z;
-    if (x < x0 || x > x1 || z < z0 || z > z1)
-        return false;
+    xz_rect::fill_hit(r, t, x, z, rec);
+    return true;
+}
+
+void
+xz_rect::fill_hit(const ray& r, float t, float x, float z, hit_record& rec) const
+{
     rec.u = (x - x0) / (x1 - x0);
     rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    rec.mat_id = mat_id;
     rec.p = r.at(t);
+}
+
+bool
+yz_rect::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    auto plane_t = (k - r.origin().x) / r.direction().x;
+    if (plane_t < t_min || plane_t > t_max)
+        return false;
+    auto y = r.origin().y + plane_t * r.direction().y;
+    auto z = r.origin().z + plane_t * r.direction().z;
+    if (y < y0 || y > y1 || z < z0 || z > z1)
+        return false;
+    t = plane_t;
     return true;
 }
 
+void
+yz_rect::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    alignas(64) float t[ray_packet::max_width];
+    alignas(64) float a[ray_packet::max_width];
+    alignas(64) float b[ray_packet::max_width];
+    uint32_t hits = packet_rect_test(packet,
+                                     lanes,
+                                     packet.origin_x,
+                                     packet.direction_x,
+                                     packet.origin_y,
+                                     packet.direction_y,
+                                     packet.origin_z,
+                                     packet.direction_z,
+                                     k,
+                                     y0,
+                                     y1,
+                                     z0,
+                                     z1,
+                                     t,
+                                     a,
+                                     b);
+    packet.record_deferred(hits, t, this, a, b);
+}
+
 bool
 yz_rect::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-    auto t = (k - r.origin().x) / r.direction().x;
-    if (t < t_min || t > t_max)
+    float t;
+    if (!yz_rect::intersect_t(r, t_min, t_max, t))
         return false;
     auto y = r.origin().y + t * r.direction().y;
     auto z = r.origin().z + t * r.direction().z;
-    if (y < y0 || y > y1 || z < z0 || z > z1)
-        return false;
+    yz_rect::fill_hit(r, t, y, z, rec);
+    return true;
+}
+
+void
+yz_rect::fill_hit(const ray& r, float t, float y, float z, hit_record& rec) const
+{
     rec.u = (y - y0) / (y1 - y0);
     rec.v = (z - z0) / (z1 - z0);
     rec.t = t;
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    rec.mat_id = mat_id;
     rec.p = r.at(t);
-    return true;
 }
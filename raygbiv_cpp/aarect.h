@@ -7,7 +7,7 @@
 
 #include "hittable.h"
 
-class xy_rect : public hittable
+class xy_rect : public deferred_hittable
 {
   public:
     xy_rect()
@@ -16,18 +16,26 @@ class xy_rect : public hittable
       , y0(0)
       , y1(0)
       , k(0)
+      , mat_id(0)
     {}
 
-    xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, shared_ptr<material> mat)
+    xy_rect(float _x0, float _x1, float _y0, float _y1, float _k, uint32_t mat)
       : x0(_x0)
       , x1(_x1)
       , y0(_y0)
       , y1(_y1)
       , k(_k)
-      , mp(mat){};
+      , mat_id(mat){};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+
+    // a and b are where the hit is in the plane of the rect
+    virtual void fill_hit(const ray& r, float t, float a, float b, hit_record& rec) const override;
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
         // The bounding box must have non-zero width in each dimension, so pad the Z
@@ -38,30 +46,30 @@ class xy_rect : public hittable
 
     virtual float pdf_value(const point3& origin, const vec3& v) const override
     {
-        hit_record rec;
-        if (!this->hit(ray(origin, v), RAY_EPSILON, infinity, rec))
+        float t;
+        if (!xy_rect::intersect_t(ray(origin, v), RAY_EPSILON, infinity, t))
             return 0;
 
         auto area = (x1 - x0) * (y1 - y0);
-        auto distance_squared = rec.t * rec.t * glm::length2(v);
-        auto cosine = fabs(dot(v, rec.normal) / v.length());
+        auto distance_squared = t * t * glm::length2(v);
+        auto cosine = fabs(dot(v, vec3(0, 0, 1)) / v.length());
 
         return distance_squared / (cosine * area);
     }
 
-    virtual vec3 random(const point3& origin) const override
+    virtual vec3 random(const point3& origin, const vec2& u) const override
     {
-        auto random_point = point3(random_float(x0, x1), random_float(y0, y1), k);
+        auto random_point = point3(x0 + u.x * (x1 - x0), y0 + u.y * (y1 - y0), k);
         return random_point - origin;
     }
 
   public:
-    shared_ptr<material> mp;
+    uint32_t mat_id;
     float x0, x1, y0, y1, k;
 };
 
 
-class xz_rect : public hittable
+class xz_rect : public deferred_hittable
 {
   public:
     xz_rect()
@@ -70,18 +78,26 @@ class xz_rect : public hittable
       , z0(0)
       , z1(0)
       , k(0)
+      , mat_id(0)
     {}
 
-    xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, shared_ptr<material> mat)
+    xz_rect(float _x0, float _x1, float _z0, float _z1, float _k, uint32_t mat)
       : x0(_x0)
       , x1(_x1)
       , z0(_z0)
       , z1(_z1)
       , k(_k)
-      , mp(mat){};
+      , mat_id(mat){};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+
+    // a and b are where the hit is in the plane of the rect
+    virtual void fill_hit(const ray& r, float t, float a, float b, hit_record& rec) const override;
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
         // The bounding box must have non-zero width in each dimension, so pad the Y
@@ -92,29 +108,29 @@ class xz_rect : public hittable
 
     virtual float pdf_value(const point3& origin, const vec3& v) const override
     {
-        hit_record rec;
-        if (!this->hit(ray(origin, v), RAY_EPSILON, infinity, rec))
+        float t;
+        if (!xz_rect::intersect_t(ray(origin, v), RAY_EPSILON, infinity, t))
             return 0;
 
         auto area = (x1 - x0) * (z1 - z0);
-        auto distance_squared = rec.t * rec.t * glm::length2(v);
-        auto cosine = fabs(dot(v, rec.normal) / v.length());
+        auto distance_squared = t * t * glm::length2(v);
+        auto cosine = fabs(dot(v, vec3(0, 1, 0)) / v.length());
 
         return distance_squared / (cosine * area);
     }
 
-    virtual vec3 random(const point3& origin) const override
+    virtual vec3 random(const point3& origin, const vec2& u) const override
     {
-        auto random_point = point3(random_float(x0, x1), k, random_float(z0, z1));
+        auto random_point = point3(x0 + u.x * (x1 - x0), k, z0 + u.y * (z1 - z0));
         return random_point - origin;
     }
 
   public:
-    shared_ptr<material> mp;
+    uint32_t mat_id;
     float x0, x1, z0, z1, k;
 };
 
-class yz_rect : public hittable
+class yz_rect : public deferred_hittable
 {
   public:
     yz_rect()
@@ -123,18 +139,26 @@ class yz_rect : public hittable
       , z0(0)
       , z1(0)
       , k(0)
+      , mat_id(0)
     {}
 
-    yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, shared_ptr<material> mat)
+    yz_rect(float _y0, float _y1, float _z0, float _z1, float _k, uint32_t mat)
       : y0(_y0)
       , y1(_y1)
       , z0(_z0)
       , z1(_z1)
       , k(_k)
-      , mp(mat){};
+      , mat_id(mat){};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+
+    // a and b are where the hit is in the plane of the rect
+    virtual void fill_hit(const ray& r, float t, float a, float b, hit_record& rec) const override;
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
         // The bounding box must have non-zero width in each dimension, so pad the X
@@ -145,25 +169,25 @@ class yz_rect : public hittable
 
     virtual float pdf_value(const point3& origin, const vec3& v) const override
     {
-        hit_record rec;
-        if (!this->hit(ray(origin, v), RAY_EPSILON, infinity, rec))
+        float t;
+        if (!yz_rect::intersect_t(ray(origin, v), RAY_EPSILON, infinity, t))
             return 0;
 
         auto area = (z1 - z0) * (y1 - y0);
-        auto distance_squared = rec.t * rec.t * glm::length2(v);
-        auto cosine = fabs(dot(v, rec.normal) / v.length());
+        auto distance_squared = t * t * glm::length2(v);
+        auto cosine = fabs(dot(v, vec3(1, 0, 0)) / v.length());
 
         return distance_squared / (cosine * area);
     }
 
-    virtual vec3 random(const point3& origin) const override
+    virtual vec3 random(const point3& origin, const vec2& u) const override
     {
-        auto random_point = point3(k, random_float(y0, y1), random_float(z0, z1));
+        auto random_point = point3(k, y0 + u.x * (y1 - y0), z0 + u.y * (z1 - z0));
         return random_point - origin;
     }
 
   public:
-    shared_ptr<material> mp;
+    uint32_t mat_id;
     float y0, y1, z0, z1, k;
 };
 #endif
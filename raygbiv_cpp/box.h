@@ -12,10 +12,25 @@ class box : public hittable
 {
   public:
     box() {}
-    box(const point3& p0, const point3& p1, shared_ptr<material> ptr);
+    box(const point3& p0, const point3& p1, uint32_t mat_id);
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override
+    {
+        return sides.intersect_t(r, t_min, t_max, t);
+    }
+
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override
+    {
+        return sides.occluded(r, t_min, t_max);
+    }
+
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override
+    {
+        sides.intersect_packet(packet, lanes);
+    }
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
         output_box = aabb(box_min, box_max);
@@ -28,19 +43,19 @@ class box : public hittable
     hittable_list sides;
 };
 
-box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr)
+box::box(const point3& p0, const point3& p1, uint32_t mat_id)
 {
     box_min = p0;
     box_max = p1;
 
-    sides.add(make_shared<xy_rect>(p0.x, p1.x, p0.y, p1.y, p1.z, ptr));
-    sides.add(make_shared<xy_rect>(p0.x, p1.x, p0.y, p1.y, p0.z, ptr));
+    sides.add(make_shared<xy_rect>(p0.x, p1.x, p0.y, p1.y, p1.z, mat_id));
+    sides.add(make_shared<xy_rect>(p0.x, p1.x, p0.y, p1.y, p0.z, mat_id));
 
-    sides.add(make_shared<xz_rect>(p0.x, p1.x, p0.z, p1.z, p1.y, ptr));
-    sides.add(make_shared<xz_rect>(p0.x, p1.x, p0.z, p1.z, p0.y, ptr));
+    sides.add(make_shared<xz_rect>(p0.x, p1.x, p0.z, p1.z, p1.y, mat_id));
+    sides.add(make_shared<xz_rect>(p0.x, p1.x, p0.z, p1.z, p0.y, mat_id));
 
-    sides.add(make_shared<yz_rect>(p0.y, p1.y, p0.z, p1.z, p1.x, ptr));
-    sides.add(make_shared<yz_rect>(p0.y, p1.y, p0.z, p1.z, p0.x, ptr));
+    sides.add(make_shared<yz_rect>(p0.y, p1.y, p0.z, p1.z, p1.x, mat_id));
+    sides.add(make_shared<yz_rect>(p0.y, p1.y, p0.z, p1.z, p0.x, mat_id));
 }
 
 bool
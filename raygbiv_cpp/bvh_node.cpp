@@ -0,0 +1,801 @@
+#include "bvh_node.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+#include "bvh_traversal.h"
+#include "threadpool.h"
+
+bool
+bvh_node::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (primitives.empty())
+        return false;
+
+    output_box = box;
+    return true;
+}
+
+bool
+bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    return traverse<false>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        if (!primitives[i]->hit(r, t_min, t_max, rec))
+            return false;
+        t_max = rec.t;
+        return true;
+    });
+}
+
+bool
+bvh_node::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    return traverse<false>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        float object_t;
+        if (!primitives[i]->intersect_t(r, t_min, t_max, object_t))
+            return false;
+        t = t_max = object_t;
+        return true;
+    });
+}
+
+bool
+bvh_node::occluded(const ray& r, float t_min, float t_max) const
+{
+    return traverse<true>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        return primitives[i]->occluded(r, t_min, t_max);
+    });
+}
+
+void
+bvh_node::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    traverse_packet(packet, lanes, [&](uint32_t i, uint32_t reached) {
+        primitives[i]->intersect_packet(packet, reached);
+    });
+}
+
+template<int N>
+int
+bvh_node::collapse(std::vector<wide_bvh_node<N>>& wide, uint32_t binary_index, int depth) const
+{
+    // start from the two children of the binary node and keep replacing the interior child with the largest box
+    // by its own two children until the wide node is full
+    uint32_t children[N];
+    int n_children = 0;
+    const linear_bvh_node& root = nodes[binary_index];
+    if (root.n_primitives > 0) {
+        children[n_children++] = binary_index;
+    } else {
+        children[n_children++] = binary_index + 1;
+        children[n_children++] = root.second_child_offset;
+    }
+    while (n_children < N) {
+        int largest = -1;
+        float largest_area = -1.0f;
+        for (int i = 0; i < n_children; ++i) {
+            const linear_bvh_node& child = nodes[children[i]];
+            if (child.n_primitives == 0 && child.bounds.surface_area() > largest_area) {
+                largest = i;
+                largest_area = child.bounds.surface_area();
+            }
+        }
+        if (largest < 0)
+            break;
+        uint32_t opened = children[largest];
+        children[largest] = opened + 1;
+        children[n_children++] = nodes[opened].second_child_offset;
+    }
+
+    // the vector grows while the children are collapsed, so the node is only ever referred to by index
+    size_t index = wide.size();
+    wide.emplace_back();
+    wide[index].n_children = static_cast<uint8_t>(n_children);
+    for (int i = 0; i < N; ++i) {
+        aabb bounds = i < n_children ? nodes[children[i]].bounds : aabb(point3(0, 0, 0), point3(0, 0, 0));
+        wide[index].min_x[i] = bounds.min().x;
+        wide[index].min_y[i] = bounds.min().y;
+        wide[index].min_z[i] = bounds.min().z;
+        wide[index].max_x[i] = bounds.max().x;
+        wide[index].max_y[i] = bounds.max().y;
+        wide[index].max_z[i] = bounds.max().z;
+        wide[index].child[i] = 0;
+        wide[index].n_primitives[i] = 0;
+    }
+
+    int deepest = depth;
+    for (int i = 0; i < n_children; ++i) {
+        const linear_bvh_node& child = nodes[children[i]];
+        if (child.n_primitives > 0) {
+            wide[index].child[i] = child.primitives_offset;
+            wide[index].n_primitives[i] = child.n_primitives;
+        } else {
+            wide[index].child[i] = static_cast<uint32_t>(wide.size());
+            deepest = std::max(deepest, collapse(wide, children[i], depth + 1));
+        }
+    }
+    return deepest;
+}
+
+// surrounding_box(b, other) in place, for the build's inner loops
+static inline void
+grow(aabb& b, const aabb& other)
+{
+    for (int a = 0; a < 3; ++a) {
+        b.minimum[a] = std::min(b.minimum[a], other.minimum[a]);
+        b.maximum[a] = std::max(b.maximum[a], other.maximum[a]);
+    }
+}
+
+static inline void
+grow(aabb& b, const point3& p)
+{
+    for (int a = 0; a < 3; ++a) {
+        b.minimum[a] = std::min(b.minimum[a], p[a]);
+        b.maximum[a] = std::max(b.maximum[a], p[a]);
+    }
+}
+
+// What the builder needs to know about one object. The records are partitioned in place,
+// so every pass over a range reads memory sequentially.
+struct bvh_build_record
+{
+    aabb bounds;
+    uint32_t index;
+
+    point3 centroid() const { return bounds.centroid(); }
+};
+
+// bounds of a range of build records and of their centroids
+struct bvh_range_bounds
+{
+    aabb bounds;
+    aabb centroid_bounds;
+
+    void add(const bvh_build_record& record, bool first)
+    {
+        point3 c = record.centroid();
+        if (first) {
+            bounds = record.bounds;
+            centroid_bounds = aabb(c, c);
+        } else {
+            grow(bounds, record.bounds);
+            grow(centroid_bounds, c);
+        }
+    }
+};
+
+// Everything one build shares between its threads. Each object's box is looked up once, and after that
+// the build only moves compact records around; threads only ever touch disjoint ranges of them.
+struct bvh_build_state
+{
+    bvh_build_state(size_t count, const bvh_build_options& build_options, raygbiv::Tasks* build_pool, int threads)
+      : options(build_options)
+      , pool(build_pool)
+    {
+        records.resize(count);
+        // enough forks to keep every thread busy while the subtrees even out, and no more: each fork costs a copy
+        fork_min_objects = std::max(bvh_node::parallel_min_objects, records.size() / (8 * threads));
+    }
+
+    bvh_range_bounds range_bounds(size_t start, size_t end) const
+    {
+        bvh_range_bounds range;
+        for (size_t i = start; i < end; ++i) {
+            range.add(records[i], i == start);
+        }
+        return range;
+    }
+
+    // runs f(start, end) over [0, n) in chunks, on the pool if there is one
+    template<class F>
+    void parallel_for(size_t n, F f)
+    {
+        if (pool == nullptr || n < parallel_chunk) {
+            f(0, n);
+            return;
+        }
+        std::vector<std::future<bool>> chunks;
+        for (size_t start = parallel_chunk; start < n; start += parallel_chunk) {
+            size_t end = std::min(start + parallel_chunk, n);
+            chunks.push_back(pool->queue([&f, start, end]() -> bool {
+                f(start, end);
+                return true;
+            }));
+        }
+        f(0, parallel_chunk);
+        for (auto& chunk : chunks) {
+            pool->wait(chunk);
+        }
+    }
+
+    static constexpr size_t parallel_chunk = 1 << 16;
+
+    const bvh_build_options& options;
+    // one record per object being built over, partitioned in place as the tree is built
+    std::vector<bvh_build_record> records;
+    // Morton code of each record's centroid, only filled in by the LBVH builder
+    std::vector<uint32_t> morton_codes;
+    // The LBVH's radix tree over the sorted records. Interior node k splits between records k and k + 1 and covers
+    // records first[k] to last[k]; children with radix_leaf set are single records.
+    std::vector<uint32_t> radix_left, radix_right, radix_first, radix_last;
+    // null for a single threaded build
+    raygbiv::Tasks* pool;
+    // smallest range whose children are worth building on different threads
+    size_t fork_min_objects;
+};
+
+// One thread's share of a build: the subtree it emits and its scratch space.
+struct bvh_build_task
+{
+    explicit bvh_build_task(const bvh_build_options& options)
+    {
+        for (auto& axis_bins : bins) {
+            axis_bins.resize(std::max(2, options.sah_bins));
+        }
+        right_cost.resize(bins[0].size());
+    }
+
+    // appends another task's finished subtree to this one
+    void append(const bvh_build_task& subtree)
+    {
+        auto base = static_cast<uint32_t>(nodes.size());
+        nodes.insert(nodes.end(), subtree.nodes.begin(), subtree.nodes.end());
+        for (size_t i = base; i < nodes.size(); ++i) {
+            if (nodes[i].n_primitives == 0)
+                nodes[i].second_child_offset += base;
+        }
+        leaves += subtree.leaves;
+        depth = std::max(depth, subtree.depth);
+    }
+
+    // depth first, with child offsets relative to the start of this vector
+    std::vector<linear_bvh_node> nodes;
+    size_t leaves = 0;
+    int depth = 0;
+
+    struct sah_bin
+    {
+        int count = 0;
+        // starts out empty so that growing it needs no special case
+        aabb bounds = aabb(point3(infinity, infinity, infinity), point3(-infinity, -infinity, -infinity));
+    };
+
+    // scratch space for the SAH sweep, reused at every level
+    std::vector<sah_bin> bins[3];
+    std::vector<float> right_cost;
+};
+
+bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects,
+                   size_t start,
+                   size_t end,
+                   float time0,
+                   float time1,
+                   const bvh_build_options& options)
+  : cost(0.0f)
+{
+    if (start >= end)
+        return;
+
+    auto build_start = std::chrono::high_resolution_clock::now();
+
+    auto order = build_nodes(
+      end - start,
+      [&](size_t i, aabb& bounds) {
+          if (!src_objects[start + i]->bounding_box(time0, time1, bounds))
+              std::cerr << "No bounding box in bvh_node constructor.\n";
+      },
+      options);
+
+    // leaves cover the objects in this order
+    primitives.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        primitives[i] = src_objects[start + order[i]];
+    }
+
+    widen(options.width);
+
+    auto build_end = std::chrono::high_resolution_clock::now();
+    stats.build_ms = std::chrono::duration<float, std::milli>(build_end - build_start).count();
+}
+
+void
+bvh_node::widen(int width)
+{
+    stats.width = width >= 8 ? 8 : width >= 4 ? 4 : 2;
+    if (stats.width == 4) {
+        nodes4.reserve(nodes.size() / 3 + 1);
+        stats.depth = collapse(nodes4, 0, 0);
+        stats.nodes = nodes4.size();
+    } else if (stats.width == 8) {
+        nodes8.reserve(nodes.size() / 7 + 1);
+        stats.depth = collapse(nodes8, 0, 0);
+        stats.nodes = nodes8.size();
+    }
+    if (stats.width != 2) {
+        nodes.clear();
+        nodes.shrink_to_fit();
+    }
+}
+
+// marks a child of the radix tree that is a single record rather than an interior node
+static constexpr uint32_t radix_leaf = 0x80000000u;
+
+// Builds the radix tree over the sorted Morton codes bottom up, in one pass over the records (Apetrei 2014). Every
+// record climbs from its leaf: a node covering [lo, hi] is a child of whichever of the splits at its two ends, between
+// lo - 1 and lo or between hi and hi + 1, has the longer common prefix. The first child to reach a parent leaves its
+// end of the range there and stops; the second takes the whole range and carries on up. Equal codes are told apart
+// by their indices. Returns the root.
+static uint32_t
+build_radix_tree(bvh_build_state& state)
+{
+    const auto& codes = state.morton_codes;
+    size_t n = codes.size();
+    if (n == 1)
+        return 0 | radix_leaf;
+
+    // the bits in which the keys of records k and k + 1 differ; the higher, the shorter their common prefix
+    auto split_key = [&](size_t k) -> uint64_t {
+        return (uint64_t(codes[k] ^ codes[k + 1]) << 32) | static_cast<uint32_t>(k ^ (k + 1));
+    };
+
+    state.radix_left.resize(n - 1);
+    state.radix_right.resize(n - 1);
+    state.radix_first.resize(n - 1);
+    state.radix_last.resize(n - 1);
+    constexpr uint32_t no_end = ~uint32_t(0);
+    std::unique_ptr<std::atomic<uint32_t>[]> other_end(new std::atomic<uint32_t>[n - 1]);
+    state.parallel_for(n - 1, [&](size_t first, size_t last) {
+        for (size_t k = first; k < last; ++k) {
+            other_end[k].store(no_end, std::memory_order_relaxed);
+        }
+    });
+
+    std::atomic<uint32_t> root(0);
+    state.parallel_for(n, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            uint32_t node = static_cast<uint32_t>(i) | radix_leaf;
+            size_t lo = i;
+            size_t hi = i;
+            while (true) {
+                if (lo == 0 && hi == n - 1) {
+                    root.store(node, std::memory_order_relaxed);
+                    break;
+                }
+                bool left_child = lo == 0 || (hi != n - 1 && split_key(hi) < split_key(lo - 1));
+                size_t parent = left_child ? hi : lo - 1;
+                (left_child ? state.radix_left : state.radix_right)[parent] = node;
+                uint32_t other = other_end[parent].exchange(static_cast<uint32_t>(left_child ? lo : hi),
+                                                            std::memory_order_acq_rel);
+                if (other == no_end)
+                    break;
+                (left_child ? hi : lo) = other;
+                node = static_cast<uint32_t>(parent);
+                state.radix_first[parent] = static_cast<uint32_t>(lo);
+                state.radix_last[parent] = static_cast<uint32_t>(hi);
+            }
+        }
+    });
+    return root.load();
+}
+
+std::vector<uint32_t>
+bvh_node::build_nodes(size_t count,
+                      const std::function<void(size_t, aabb&)>& bounds_of,
+                      const bvh_build_options& options)
+{
+    // small trees are not worth starting threads for
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+    if (count < 2 * parallel_min_objects)
+        threads = 1;
+    threads = std::max(threads, 1);
+
+    raygbiv::Tasks pool;
+    if (threads > 1)
+        pool.start(threads - 1);
+
+    bvh_build_state state(count, options, threads > 1 ? &pool : nullptr, threads);
+    state.parallel_for(state.records.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            state.records[i].index = static_cast<uint32_t>(i);
+            bounds_of(i, state.records[i].bounds);
+        }
+    });
+
+    bvh_build_task root(options);
+    root.nodes.reserve(2 * state.records.size());
+    auto root_range = state.range_bounds(0, state.records.size());
+    if (options.split_method == bvh_split_method::lbvh) {
+        sort_morton(state, root_range);
+        cost = traversal_cost + build_morton(state, root, build_radix_tree(state), 0);
+    } else {
+        cost = traversal_cost + build_recursive(state, root, 0, state.records.size(), 0, root_range);
+    }
+
+    // leaves cover the records in order, so the records now list the objects in leaf order
+    std::vector<uint32_t> order(state.records.size());
+    state.parallel_for(state.records.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            order[i] = state.records[i].index;
+        }
+    });
+    nodes = std::move(root.nodes);
+    // the space reserved above is a bound twice the size of a tree with one object per leaf
+    nodes.shrink_to_fit();
+    box = nodes[0].bounds;
+    stats.nodes = nodes.size();
+    stats.leaves = root.leaves;
+    stats.depth = root.depth;
+    stats.width = 2;
+    stats.threads = threads;
+    return order;
+}
+
+float
+bvh_node::build_recursive(bvh_build_state& state,
+                          bvh_build_task& task,
+                          size_t start,
+                          size_t end,
+                          int depth,
+                          const bvh_range_bounds& range)
+{
+    auto& nodes = task.nodes;
+    const aabb& bounds = range.bounds;
+    size_t node_index = nodes.size();
+    nodes.emplace_back();
+    nodes[node_index].bounds = bounds;
+    task.depth = std::max(task.depth, depth);
+
+    int axis = 0;
+    bvh_range_bounds children[2];
+    size_t mid = (state.options.split_method == bvh_split_method::median)
+                   ? split_median(state, start, end, axis, children)
+                   : split_sah(state, task, start, end, depth, range, axis, children);
+
+    if (mid == end) {
+        linear_bvh_node& leaf = nodes[node_index];
+        leaf.primitives_offset = static_cast<uint32_t>(start);
+        leaf.n_primitives = static_cast<uint16_t>(end - start);
+        task.leaves++;
+        return intersection_cost * (end - start);
+    }
+
+    // both child boxes are tested once this node is entered, but each child is only entered when its box is hit
+    float left_cost;
+    float right_cost;
+    size_t second_child;
+    if (state.pool != nullptr && std::min(mid - start, end - mid) >= state.fork_min_objects) {
+        // hand the second child to another thread and build the first one here, straight into place
+        bvh_build_task right_task(state.options);
+        auto right_job = state.pool->queue([&]() -> bool {
+            right_cost = build_recursive(state, right_task, mid, end, depth + 1, children[1]);
+            return true;
+        });
+        left_cost = build_recursive(state, task, start, mid, depth + 1, children[0]);
+        state.pool->wait(right_job);
+        second_child = nodes.size();
+        task.append(right_task);
+    } else {
+        left_cost = build_recursive(state, task, start, mid, depth + 1, children[0]);
+        second_child = nodes.size();
+        right_cost = build_recursive(state, task, mid, end, depth + 1, children[1]);
+    }
+
+    linear_bvh_node& node = nodes[node_index];
+    node.second_child_offset = static_cast<uint32_t>(second_child);
+    node.n_primitives = 0;
+    node.axis = static_cast<uint8_t>(axis);
+
+    auto area = bounds.surface_area();
+    auto p_left = area > 0.0f ? nodes[node_index + 1].bounds.surface_area() / area : 1.0f;
+    auto p_right = area > 0.0f ? nodes[second_child].bounds.surface_area() / area : 1.0f;
+    return 2.0f * traversal_cost + p_left * left_cost + p_right * right_cost;
+}
+
+// spreads the low 10 bits of v out so that there are two zero bits between each of them
+static inline uint32_t
+expand_bits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xff0000ffu;
+    v = (v * 0x00000101u) & 0x0f00f00fu;
+    v = (v * 0x00000011u) & 0xc30c30c3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+void
+bvh_node::sort_morton(bvh_build_state& state, const bvh_range_bounds& range)
+{
+    auto& records = state.records;
+    auto& codes = state.morton_codes;
+    size_t n = records.size();
+    codes.resize(n);
+
+    // quantize each centroid to 10 bits per axis within the centroid bounds and interleave the bits
+    vec3 lo = range.centroid_bounds.min();
+    vec3 extent = range.centroid_bounds.max() - lo;
+    vec3 scale;
+    for (int a = 0; a < 3; ++a) {
+        scale[a] = extent[a] > 0.0f ? 1023.0f / extent[a] : 0.0f;
+    }
+    state.parallel_for(n, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            vec3 q = (records[i].centroid() - lo) * scale;
+            uint32_t code = 0;
+            for (int a = 0; a < 3; ++a) {
+                auto cell = static_cast<uint32_t>(std::min(std::max(q[a], 0.0f), 1023.0f));
+                code |= expand_bits(cell) << (2 - a);
+            }
+            codes[i] = code;
+        }
+    });
+
+    // least significant digit radix sort, 8 bits per pass. Every chunk counts its digits on its own, and the
+    // offsets are laid out digit by digit and chunk by chunk within a digit, which keeps each pass stable.
+    constexpr int digit_bits = 8;
+    constexpr size_t radix = size_t(1) << digit_bits;
+    const size_t chunk = bvh_build_state::parallel_chunk;
+    size_t n_chunks = (n + chunk - 1) / chunk;
+    std::vector<size_t> offsets(n_chunks * radix);
+    std::vector<uint32_t> codes_out(n);
+    std::vector<bvh_build_record> records_out(n);
+    for (int shift = 0; shift < 30; shift += digit_bits) {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        state.parallel_for(n, [&](size_t first, size_t last) {
+            size_t* count = &offsets[first / chunk * radix];
+            for (size_t i = first; i < last; ++i) {
+                count[(codes[i] >> shift) & (radix - 1)]++;
+            }
+        });
+        size_t sum = 0;
+        for (size_t digit = 0; digit < radix; ++digit) {
+            for (size_t c = 0; c < n_chunks; ++c) {
+                size_t count = offsets[c * radix + digit];
+                offsets[c * radix + digit] = sum;
+                sum += count;
+            }
+        }
+        state.parallel_for(n, [&](size_t first, size_t last) {
+            size_t* next = &offsets[first / chunk * radix];
+            for (size_t i = first; i < last; ++i) {
+                size_t to = next[(codes[i] >> shift) & (radix - 1)]++;
+                codes_out[to] = codes[i];
+                records_out[to] = records[i];
+            }
+        });
+        codes.swap(codes_out);
+        records.swap(records_out);
+    }
+}
+
+float
+bvh_node::build_morton(bvh_build_state& state, bvh_build_task& task, uint32_t radix_node, int depth)
+{
+    auto& nodes = task.nodes;
+    const auto& codes = state.morton_codes;
+    size_t node_index = nodes.size();
+    nodes.emplace_back();
+    task.depth = std::max(task.depth, depth);
+
+    bool single = (radix_node & radix_leaf) != 0;
+    size_t start = single ? radix_node & ~radix_leaf : state.radix_first[radix_node];
+    size_t end = single ? start + 1 : state.radix_last[radix_node] + 1;
+    size_t object_span = end - start;
+    size_t max_leaf_size = static_cast<size_t>(std::min(std::max(1, state.options.max_leaf_size), 0xffff));
+    if (object_span <= max_leaf_size) {
+        linear_bvh_node& leaf = nodes[node_index];
+        leaf.bounds = state.range_bounds(start, end).bounds;
+        leaf.primitives_offset = static_cast<uint32_t>(start);
+        leaf.n_primitives = static_cast<uint16_t>(object_span);
+        task.leaves++;
+        return intersection_cost * object_span;
+    }
+
+    // the split is on the axis of the highest bit that differs across the range, if any does
+    size_t mid = radix_node + 1;
+    uint32_t differing = codes[start] ^ codes[end - 1];
+    int axis = 0;
+    if (differing != 0) {
+        int bit = 31;
+        while (!(differing & (1u << bit))) {
+            --bit;
+        }
+        axis = 2 - bit % 3;
+    }
+    uint32_t left = state.radix_left[radix_node];
+    uint32_t right = state.radix_right[radix_node];
+
+    float left_cost;
+    float right_cost;
+    size_t second_child;
+    if (state.pool != nullptr && std::min(mid - start, end - mid) >= state.fork_min_objects) {
+        bvh_build_task right_task(state.options);
+        auto right_job = state.pool->queue([&]() -> bool {
+            right_cost = build_morton(state, right_task, right, depth + 1);
+            return true;
+        });
+        left_cost = build_morton(state, task, left, depth + 1);
+        state.pool->wait(right_job);
+        second_child = nodes.size();
+        task.append(right_task);
+    } else {
+        left_cost = build_morton(state, task, left, depth + 1);
+        second_child = nodes.size();
+        right_cost = build_morton(state, task, right, depth + 1);
+    }
+
+    // bounds are gathered bottom up, from the children just emitted
+    linear_bvh_node& node = nodes[node_index];
+    node.bounds = surrounding_box(nodes[node_index + 1].bounds, nodes[second_child].bounds);
+    node.second_child_offset = static_cast<uint32_t>(second_child);
+    node.n_primitives = 0;
+    node.axis = static_cast<uint8_t>(axis);
+
+    auto area = node.bounds.surface_area();
+    auto p_left = area > 0.0f ? nodes[node_index + 1].bounds.surface_area() / area : 1.0f;
+    auto p_right = area > 0.0f ? nodes[second_child].bounds.surface_area() / area : 1.0f;
+    return 2.0f * traversal_cost + p_left * left_cost + p_right * right_cost;
+}
+
+size_t
+bvh_node::split_median(bvh_build_state& state, size_t start, size_t end, int& axis, bvh_range_bounds* children)
+{
+    size_t object_span = end - start;
+    if (object_span <= 2)
+        return end;
+
+    axis = random_int(0, 2);
+
+    auto mid = start + object_span / 2;
+    std::nth_element(state.records.begin() + start,
+                     state.records.begin() + mid,
+                     state.records.begin() + end,
+                     [&](const bvh_build_record& a, const bvh_build_record& b) {
+                         return a.bounds.min()[axis] < b.bounds.min()[axis];
+                     });
+    children[0] = state.range_bounds(start, mid);
+    children[1] = state.range_bounds(mid, end);
+    return mid;
+}
+
+size_t
+bvh_node::split_sah(bvh_build_state& state,
+                    bvh_build_task& task,
+                    size_t start,
+                    size_t end,
+                    int depth,
+                    const bvh_range_bounds& range,
+                    int& axis,
+                    bvh_range_bounds* children)
+{
+    const aabb& bounds = range.bounds;
+    const aabb& centroid_bounds = range.centroid_bounds;
+    size_t object_span = end - start;
+    size_t max_leaf_size = static_cast<size_t>(std::min(std::max(1, state.options.max_leaf_size), 0xffff));
+    if (object_span == 1)
+        return end;
+
+    // past half the stack depth, stop trusting the SAH and halve the range so the tree stays shallow enough
+    if (depth >= max_depth / 2) {
+        if (object_span <= max_leaf_size)
+            return end;
+        vec3 extent = centroid_bounds.max() - centroid_bounds.min();
+        axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+        auto mid = start + object_span / 2;
+        std::nth_element(state.records.begin() + start,
+                         state.records.begin() + mid,
+                         state.records.begin() + end,
+                         [&](const bvh_build_record& a, const bvh_build_record& b) {
+                             return a.centroid()[axis] < b.centroid()[axis];
+                         });
+        children[0] = state.range_bounds(start, mid);
+        children[1] = state.range_bounds(mid, end);
+        return mid;
+    }
+
+    auto& right_cost = task.right_cost;
+    // small ranges near the leaves gain nothing from more bins than objects, and there are a lot of them
+    int nbins = static_cast<int>(std::min(right_cost.size(), std::max<size_t>(object_span, 2)));
+    vec3 centroid_lo = centroid_bounds.min();
+    vec3 centroid_extent = centroid_bounds.max() - centroid_lo;
+    vec3 bin_scale;
+    for (int a = 0; a < 3; ++a) {
+        bin_scale[a] = centroid_extent[a] > 0.0f ? nbins / centroid_extent[a] : 0.0f;
+    }
+    auto bin_of = [&](const bvh_build_record& record, int axis) {
+        int bin = static_cast<int>((record.centroid()[axis] - centroid_lo[axis]) * bin_scale[axis]);
+        return std::min(std::max(bin, 0), nbins - 1);
+    };
+
+    // expected cost of one side of a split, assuming it becomes a leaf
+    auto area = bounds.surface_area();
+    auto side_cost = [&](int count, const aabb& side_bounds) {
+        if (count == 0)
+            return 0.0f;
+        return traversal_cost + intersection_cost * count * side_bounds.surface_area() / area;
+    };
+
+    // find the cheapest split plane between bins over all three axes
+    float best_cost = infinity;
+    int best_axis = -1;
+    int best_split = -1;
+    if (area > 0.0f) {
+        // bin every axis in a single pass over the records
+        for (auto& axis_bins : task.bins) {
+            std::fill(axis_bins.begin(), axis_bins.begin() + nbins, bvh_build_task::sah_bin());
+        }
+        for (size_t i = start; i < end; ++i) {
+            const auto& record = state.records[i];
+            for (int a = 0; a < 3; ++a) {
+                if (centroid_extent[a] <= 0.0f)
+                    continue;
+                auto& bin = task.bins[a][bin_of(record, a)];
+                bin.count++;
+                grow(bin.bounds, record.bounds);
+            }
+        }
+
+        for (int a = 0; a < 3; ++a) {
+            if (centroid_extent[a] <= 0.0f)
+                continue;
+            const auto& bins = task.bins[a];
+
+            // sweep from the right to find the cost of every right side, then from the left to evaluate each split
+            bvh_build_task::sah_bin accum;
+            for (int b = nbins - 1; b > 0; --b) {
+                accum.count += bins[b].count;
+                grow(accum.bounds, bins[b].bounds);
+                right_cost[b - 1] = side_cost(accum.count, accum.bounds);
+            }
+            accum = bvh_build_task::sah_bin();
+            for (int b = 0; b < nbins - 1; ++b) {
+                accum.count += bins[b].count;
+                grow(accum.bounds, bins[b].bounds);
+                int count = accum.count;
+                if (count == 0 || count == static_cast<int>(object_span))
+                    continue;
+                float split_cost = side_cost(count, accum.bounds) + right_cost[b];
+                if (split_cost < best_cost) {
+                    best_cost = split_cost;
+                    best_axis = a;
+                    best_split = b;
+                }
+            }
+        }
+    }
+
+    float leaf_cost = intersection_cost * object_span;
+    if (object_span <= max_leaf_size && (best_axis < 0 || leaf_cost <= best_cost))
+        return end;
+
+    if (best_axis < 0) {
+        // every centroid coincides, so no plane separates them: split the range in half as given
+        auto mid = start + object_span / 2;
+        children[0] = state.range_bounds(start, mid);
+        children[1] = state.range_bounds(mid, end);
+        return mid;
+    }
+
+    // partition around the split plane, collecting the bounds of both sides on the way
+    axis = best_axis;
+    size_t left = start;
+    size_t right = end;
+    while (true) {
+        while (left < right && bin_of(state.records[left], best_axis) <= best_split) {
+            children[0].add(state.records[left], left == start);
+            ++left;
+        }
+        while (left < right && bin_of(state.records[right - 1], best_axis) > best_split) {
+            --right;
+            children[1].add(state.records[right], right == end - 1);
+        }
+        if (left == right)
+            break;
+        std::swap(state.records[left], state.records[right - 1]);
+    }
+    return left;
+}
@@ -3,120 +3,249 @@
 #ifndef BVH_H
 #define BVH_H
 
-#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
 
 #include "rtweekend.h"
 
 #include "hittable.h"
 #include "hittable_list.h"
 
-class bvh_node : public hittable
+enum class bvh_split_method
 {
-  public:
-    bvh_node();
+    // sort along a random axis and split at the object median
+    median,
+    // binned surface area heuristic, evaluated over all three axes
+    sah,
+    // linear bvh: sort the objects along a 30-bit Morton curve through their centroids and build the radix tree over
+    // the codes bottom up in one pass; the fastest to build, for scenes rebuilt every frame, at some cost in quality
+    lbvh
+};
 
-    bvh_node(const hittable_list& list, float time0, float time1)
-      : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
-    {}
+struct bvh_build_options
+{
+    bvh_split_method split_method = bvh_split_method::sah;
+    // number of centroid bins per axis tried by the SAH builder
+    int sah_bins = 12;
+    // the SAH and LBVH builders never make a leaf holding more objects than this
+    int max_leaf_size = 4;
+    // threads used to build large trees, counting the calling thread; 0 uses every core
+    int threads = 0;
+    // children per node: 2, or 4 or 8 to collapse the built tree into a wide one whose child boxes are tested at once
+    int width = 2;
+};
 
-    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects, size_t start, size_t end, float time0, float time1);
+// what the last build produced and how long it took
+struct bvh_build_stats
+{
+    size_t nodes = 0;
+    size_t leaves = 0;
+    int depth = 0;
+    float build_ms = 0.0f;
+    int threads = 1;
+    int width = 2;
+};
 
-    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+// A read only run of elements stored somewhere else: in a vector, or in a memory mapped file.
+template<class T>
+struct array_view
+{
+    array_view() {}
+    array_view(const T* data, size_t size)
+      : data(data)
+      , size(size)
+    {}
+    array_view(const std::vector<T>& v)
+      : data(v.data())
+      , size(v.size())
+    {}
 
-    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+    const T& operator[](size_t i) const { return data[i]; }
+    bool empty() const { return size == 0; }
 
-  public:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb box;
+    const T* data = nullptr;
+    size_t size = 0;
 };
 
-bool
-bvh_node::bounding_box(float time0, float time1, aabb& output_box) const
+// One node of the flattened tree. Nodes are stored in depth-first order, so the
+// first child of an interior node is always the node right after it.
+struct alignas(32) linear_bvh_node
 {
-    output_box = box;
-    return true;
-}
+    aabb bounds;
+    union
+    {
+        uint32_t primitives_offset;   // leaf: first object in bvh_node::primitives
+        uint32_t second_child_offset; // interior: index of the second child
+    };
+    uint16_t n_primitives; // 0 for interior nodes
+    uint8_t axis;          // split axis of an interior node
+};
 
-bool
-bvh_node::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node should be half a cache line");
+
+// One node of a wide tree, with the boxes of its N children stored axis by axis so that they can be tested
+// against a ray in one go. Only the first n_children slots are used.
+template<int N>
+struct alignas(32) wide_bvh_node
 {
-    if (!box.hit(r, t_min, t_max))
-        return false;
+    float min_x[N], min_y[N], min_z[N];
+    float max_x[N], max_y[N], max_z[N];
+    // index of the child node, or of the child's first object in bvh_node::primitives if it is a leaf
+    uint32_t child[N];
+    // 0 for interior children
+    uint16_t n_primitives[N];
+    uint8_t n_children;
+};
 
-    bool hit_left = left->hit(r, t_min, t_max, rec);
-    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+using bvh4_node = wide_bvh_node<4>;
+using bvh8_node = wide_bvh_node<8>;
 
-    return hit_left || hit_right;
-}
+struct bvh_build_state;
+struct bvh_build_task;
+struct bvh_range_bounds;
 
-inline bool
-box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis)
+class bvh_node : public hittable
 {
-    aabb box_a;
-    aabb box_b;
+  public:
+    bvh_node()
+      : cost(0.0f)
+    {}
 
-    if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
+    bvh_node(const hittable_list& list,
+             float time0,
+             float time1,
+             const bvh_build_options& options = bvh_build_options())
+      : bvh_node(list.objects, 0, list.objects.size(), time0, time1, options)
+    {}
 
-    return box_a.min()[axis] < box_b.min()[axis];
-}
+    bvh_node(const std::vector<shared_ptr<hittable>>& src_objects,
+             size_t start,
+             size_t end,
+             float time0,
+             float time1,
+             const bvh_build_options& options = bvh_build_options());
 
-bool
-box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
-{
-    return box_compare(a, b, 0);
-}
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
-bool
-box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
-{
-    return box_compare(a, b, 1);
-}
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
 
-bool
-box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
-{
-    return box_compare(a, b, 2);
-}
-
-bvh_node::bvh_node(const std::vector<shared_ptr<hittable>>& src_objects,
-                   size_t start,
-                   size_t end,
-                   float time0,
-                   float time1)
-{
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
-
-    int axis = random_int(0, 2);
-    auto comparator = (axis == 0) ? box_x_compare : (axis == 1) ? box_y_compare : box_z_compare;
-
-    size_t object_span = end - start;
-
-    if (object_span == 1) {
-        left = right = objects[start];
-    } else if (object_span == 2) {
-        if (comparator(objects[start], objects[start + 1])) {
-            left = objects[start];
-            right = objects[start + 1];
-        } else {
-            left = objects[start + 1];
-            right = objects[start];
-        }
-    } else {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
-
-        auto mid = start + object_span / 2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
-    }
-
-    aabb box_left, box_right;
-
-    if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
-
-    box = surrounding_box(box_left, box_right);
-}
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+    // expected cost of tracing a ray that enters the root box, measured in primitive intersections
+    float sah_cost() const { return cost; }
+
+    // relative costs of one box test and one primitive intersection used by the SAH
+    static constexpr float traversal_cost = 1.0f;
+    static constexpr float intersection_cost = 1.0f;
+
+    // deepest tree the traversal stack can hold
+    static constexpr int max_depth = 64;
+
+    // ranges smaller than this are never handed to another thread
+    static constexpr size_t parallel_min_objects = 4096;
+
+  protected:
+    // Builds the binary tree over count objects into nodes, and sets box, cost and stats for it. bounds_of(i, bounds)
+    // gives the box of object i. Returns the objects' indices in the order the leaves refer to them.
+    std::vector<uint32_t> build_nodes(size_t count,
+                                      const std::function<void(size_t, aabb&)>& bounds_of,
+                                      const bvh_build_options& options);
+
+    // collapses the binary tree into one with 4 or 8 children per node, as bvh_build_options::width asks for
+    void widen(int width);
+
+    // Walks the tree near to far and calls intersect(i, t_min, t_max) for the objects in every leaf the ray reaches,
+    // where i is the object's index in leaf order. intersect returns whether the object was hit, lowering t_max to the
+    // hit if it wants the closest one. With any_hit the walk stops at the first object that is hit. Defined in
+    // bvh_traversal.h.
+    template<bool any_hit, class Intersect>
+    bool traverse(const ray& r, float t_min, float t_max, Intersect&& intersect) const;
+
+    template<bool any_hit, class Intersect>
+    bool traverse_binary(array_view<linear_bvh_node> binary,
+                         const ray& r,
+                         float t_min,
+                         float t_max,
+                         Intersect&& intersect) const;
+
+    template<int N, bool any_hit, class Intersect>
+    bool traverse_wide(array_view<wide_bvh_node<N>> wide,
+                       const ray& r,
+                       float t_min,
+                       float t_max,
+                       Intersect&& intersect) const;
+
+    // Walks the tree once for all of lanes and calls intersect(i, lanes) for the objects in every leaf that any of
+    // them reach, with the lanes that reach it. Children are visited in the order the first of the lanes would visit
+    // them in, and skipped once every lane has found a closer hit. Defined in bvh_traversal.h.
+    template<class Intersect>
+    void traverse_packet(ray_packet& packet, uint32_t lanes, Intersect&& intersect) const;
+
+    template<class Intersect>
+    void traverse_packet_binary(array_view<linear_bvh_node> binary,
+                                ray_packet& packet,
+                                uint32_t lanes,
+                                Intersect&& intersect) const;
+
+    template<int N, class Intersect>
+    void traverse_packet_wide(array_view<wide_bvh_node<N>> wide,
+                              ray_packet& packet,
+                              uint32_t lanes,
+                              Intersect&& intersect) const;
+
+  private:
+    // sorts state.records along the Morton curve through the centroid bounds of range
+    void sort_morton(bvh_build_state& state, const bvh_range_bounds& range);
+
+    // like build_recursive, emitting the subtree of radix_node of the radix tree built over the records in Morton
+    // order; node bounds are gathered bottom up
+    float build_morton(bvh_build_state& state, bvh_build_task& task, uint32_t radix_node, int depth);
+
+    // rebuilds nodes as a tree of N wide nodes, each pulling up the largest of its binary descendants
+    template<int N>
+    int collapse(std::vector<wide_bvh_node<N>>& wide, uint32_t binary_index, int depth) const;
+
+    // appends the subtree over state.records[start, end) to task.nodes and returns the expected cost of a ray entering
+    // it; large enough subtrees are built by other threads and copied in once they are done
+    float build_recursive(bvh_build_state& state,
+                          bvh_build_task& task,
+                          size_t start,
+                          size_t end,
+                          int depth,
+                          const bvh_range_bounds& range);
+
+    // the split functions reorder state.records[start, end) and return the index where the second child begins,
+    // or end if the range should become a leaf; on a split they also fill in the bounds of both children
+    size_t split_median(bvh_build_state& state, size_t start, size_t end, int& axis, bvh_range_bounds* children);
+
+    size_t split_sah(bvh_build_state& state,
+                     bvh_build_task& task,
+                     size_t start,
+                     size_t end,
+                     int depth,
+                     const bvh_range_bounds& range,
+                     int& axis,
+                     bvh_range_bounds* children);
+
+  public:
+    aabb box;
+    // the binary tree; cleared when the tree is collapsed to a wider one
+    std::vector<linear_bvh_node> nodes;
+    std::vector<bvh4_node> nodes4;
+    std::vector<bvh8_node> nodes8;
+    // a tree that lives elsewhere, such as in a memory mapped cache file; traversed when the vectors above are empty
+    array_view<linear_bvh_node> mapped_nodes;
+    array_view<bvh4_node> mapped_nodes4;
+    array_view<bvh8_node> mapped_nodes8;
+    // objects in leaf order; each leaf refers to a contiguous range
+    std::vector<shared_ptr<hittable>> primitives;
+    float cost;
+    bvh_build_stats stats;
+};
 
 #endif
@@ -0,0 +1,369 @@
+#pragma once
+
+#ifndef BVH_TRAVERSAL_H
+#define BVH_TRAVERSAL_H
+
+// The traversal templates of bvh_node, for the files that build structures on top of it.
+
+#include "bvh_node.h"
+
+#include <algorithm>
+
+#include "ray_packet.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define BVH_SSE
+#include <immintrin.h>
+#endif
+
+template<bool any_hit, class Intersect>
+bool
+bvh_node::traverse(const ray& r, float t_min, float t_max, Intersect&& intersect) const
+{
+    if (!nodes4.empty())
+        return traverse_wide<4, any_hit>(nodes4, r, t_min, t_max, intersect);
+    if (!nodes8.empty())
+        return traverse_wide<8, any_hit>(nodes8, r, t_min, t_max, intersect);
+    if (!nodes.empty())
+        return traverse_binary<any_hit>(nodes, r, t_min, t_max, intersect);
+    if (!mapped_nodes4.empty())
+        return traverse_wide<4, any_hit>(mapped_nodes4, r, t_min, t_max, intersect);
+    if (!mapped_nodes8.empty())
+        return traverse_wide<8, any_hit>(mapped_nodes8, r, t_min, t_max, intersect);
+    return traverse_binary<any_hit>(mapped_nodes, r, t_min, t_max, intersect);
+}
+
+template<bool any_hit, class Intersect>
+bool
+bvh_node::traverse_binary(array_view<linear_bvh_node> binary,
+                          const ray& r,
+                          float t_min,
+                          float t_max,
+                          Intersect&& intersect) const
+{
+    if (binary.empty())
+        return false;
+
+    bool hit_anything = false;
+
+    // nodes still to be visited
+    int to_visit[max_depth];
+    int to_visit_count = 0;
+    int current = 0;
+    while (true) {
+        const linear_bvh_node& node = binary[current];
+        if (node.bounds.hit(r, t_min, t_max)) {
+            if (node.n_primitives > 0) {
+                for (int i = 0; i < node.n_primitives; ++i) {
+                    if (intersect(node.primitives_offset + i, t_min, t_max)) {
+                        if (any_hit)
+                            return true;
+                        hit_anything = true;
+                    }
+                }
+            } else {
+                // visit the child on the near side of the split first; the far one is culled by its box test
+                // when popped if a closer hit was found in the meantime
+                if ((r.sign_mask() >> node.axis) & 1) {
+                    to_visit[to_visit_count++] = current + 1;
+                    current = node.second_child_offset;
+                } else {
+                    to_visit[to_visit_count++] = node.second_child_offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (to_visit_count == 0)
+            break;
+        current = to_visit[--to_visit_count];
+    }
+
+    return hit_anything;
+}
+
+// Tests a ray against the boxes of all children of a wide node. Returns a bit for every child whose box the ray
+// is inside of somewhere in [t_min, t_max], and fills in where it enters each box.
+template<int N>
+static inline int
+slab_test(const wide_bvh_node<N>& node,
+          const float* origin,
+          const float* inv_dir,
+          float t_min,
+          float t_max,
+          float* t_near)
+{
+    const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+    const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+    int mask = 0;
+    for (int i = 0; i < N; ++i) {
+        float t_enter = t_min;
+        float t_exit = t_max;
+        for (int a = 0; a < 3; ++a) {
+            float t0 = (lo[a][i] - origin[a]) * inv_dir[a];
+            float t1 = (hi[a][i] - origin[a]) * inv_dir[a];
+            t_enter = std::max(t_enter, std::min(t0, t1));
+            t_exit = std::min(t_exit, std::max(t0, t1));
+        }
+        t_near[i] = t_enter;
+        mask |= (t_enter <= t_exit) << i;
+    }
+    return mask;
+}
+
+#ifdef BVH_SSE
+template<>
+inline int
+slab_test<4>(const bvh4_node& node,
+             const float* origin,
+             const float* inv_dir,
+             float t_min,
+             float t_max,
+             float* t_near)
+{
+    const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+    const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+    __m128 t_enter = _mm_set1_ps(t_min);
+    __m128 t_exit = _mm_set1_ps(t_max);
+    for (int a = 0; a < 3; ++a) {
+        __m128 o = _mm_set1_ps(origin[a]);
+        __m128 inv = _mm_set1_ps(inv_dir[a]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(lo[a]), o), inv);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(hi[a]), o), inv);
+        t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+        t_exit = _mm_min_ps(t_exit, _mm_max_ps(t0, t1));
+    }
+    _mm_storeu_ps(t_near, t_enter);
+    return _mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+}
+#endif
+
+#if defined(BVH_SSE) && defined(__AVX__)
+template<>
+inline int
+slab_test<8>(const bvh8_node& node,
+             const float* origin,
+             const float* inv_dir,
+             float t_min,
+             float t_max,
+             float* t_near)
+{
+    const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+    const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+    __m256 t_enter = _mm256_set1_ps(t_min);
+    __m256 t_exit = _mm256_set1_ps(t_max);
+    for (int a = 0; a < 3; ++a) {
+        __m256 o = _mm256_set1_ps(origin[a]);
+        __m256 inv = _mm256_set1_ps(inv_dir[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(lo[a]), o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(hi[a]), o), inv);
+        t_enter = _mm256_max_ps(t_enter, _mm256_min_ps(t0, t1));
+        t_exit = _mm256_min_ps(t_exit, _mm256_max_ps(t0, t1));
+    }
+    _mm256_storeu_ps(t_near, t_enter);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ));
+}
+#endif
+
+template<int N, bool any_hit, class Intersect>
+bool
+bvh_node::traverse_wide(array_view<wide_bvh_node<N>> wide,
+                        const ray& r,
+                        float t_min,
+                        float t_max,
+                        Intersect&& intersect) const
+{
+    const float origin[3] = { r.orig.x, r.orig.y, r.orig.z };
+    const float inv_dir[3] = { r.inv_dir.x, r.inv_dir.y, r.inv_dir.z };
+
+    struct visit
+    {
+        uint32_t child;
+        uint16_t n_primitives;
+        // where the ray enters the child's box
+        float t;
+    };
+
+    bool hit_anything = false;
+
+    // every level leaves at most N - 1 siblings behind on the stack
+    visit to_visit[max_depth * (N - 1) + 1];
+    int to_visit_count = 0;
+    to_visit[to_visit_count++] = { 0, 0, t_min };
+    while (to_visit_count > 0) {
+        visit current = to_visit[--to_visit_count];
+        // skip children that are behind a hit found since they were pushed
+        if (current.t > t_max)
+            continue;
+
+        if (current.n_primitives > 0) {
+            for (int i = 0; i < current.n_primitives; ++i) {
+                if (intersect(current.child + i, t_min, t_max)) {
+                    if (any_hit)
+                        return true;
+                    hit_anything = true;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = wide[current.child];
+        float t_near[N];
+        int mask = slab_test<N>(node, origin, inv_dir, t_min, t_max, t_near) & ((1 << node.n_children) - 1);
+
+        // push the children that were hit far to near, so the nearest one is visited next
+        int first = to_visit_count;
+        for (int i = 0; i < N; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            visit child = { node.child[i], node.n_primitives[i], t_near[i] };
+            int j = to_visit_count++;
+            while (j > first && to_visit[j - 1].t < child.t) {
+                to_visit[j] = to_visit[j - 1];
+                --j;
+            }
+            to_visit[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
+
+template<class Intersect>
+void
+bvh_node::traverse_packet(ray_packet& packet, uint32_t lanes, Intersect&& intersect) const
+{
+    if (!nodes4.empty())
+        return traverse_packet_wide<4>(nodes4, packet, lanes, intersect);
+    if (!nodes8.empty())
+        return traverse_packet_wide<8>(nodes8, packet, lanes, intersect);
+    if (!nodes.empty())
+        return traverse_packet_binary(nodes, packet, lanes, intersect);
+    if (!mapped_nodes4.empty())
+        return traverse_packet_wide<4>(mapped_nodes4, packet, lanes, intersect);
+    if (!mapped_nodes8.empty())
+        return traverse_packet_wide<8>(mapped_nodes8, packet, lanes, intersect);
+    return traverse_packet_binary(mapped_nodes, packet, lanes, intersect);
+}
+
+// the index of the lowest lane of lanes
+inline int
+first_lane(uint32_t lanes)
+{
+    int lane = 0;
+    while (!((lanes >> lane) & 1))
+        ++lane;
+    return lane;
+}
+
+template<class Intersect>
+void
+bvh_node::traverse_packet_binary(array_view<linear_bvh_node> binary,
+                                 ray_packet& packet,
+                                 uint32_t lanes,
+                                 Intersect&& intersect) const
+{
+    if (binary.empty() || lanes == 0)
+        return;
+
+    const float* direction[3] = { packet.direction_x, packet.direction_y, packet.direction_z };
+
+    struct visit
+    {
+        int node;
+        // the lanes that entered the parent's box
+        uint32_t lanes;
+    };
+
+    visit to_visit[max_depth];
+    int to_visit_count = 0;
+    visit current = { 0, lanes };
+    while (true) {
+        const linear_bvh_node& node = binary[current.node];
+        const point3 lo = node.bounds.min(), hi = node.bounds.max();
+        uint32_t active = packet_box_test(packet, current.lanes, lo.x, lo.y, lo.z, hi.x, hi.y, hi.z);
+        if (active != 0) {
+            if (node.n_primitives > 0) {
+                for (int i = 0; i < node.n_primitives; ++i)
+                    intersect(node.primitives_offset + i, active);
+            } else {
+                // near side first for the first active lane; coherent rays mostly agree with it
+                if (direction[node.axis][first_lane(active)] < 0.0f) {
+                    to_visit[to_visit_count++] = { current.node + 1, active };
+                    current = { static_cast<int>(node.second_child_offset), active };
+                } else {
+                    to_visit[to_visit_count++] = { static_cast<int>(node.second_child_offset), active };
+                    current = { current.node + 1, active };
+                }
+                continue;
+            }
+        }
+        if (to_visit_count == 0)
+            break;
+        current = to_visit[--to_visit_count];
+    }
+}
+
+template<int N, class Intersect>
+void
+bvh_node::traverse_packet_wide(array_view<wide_bvh_node<N>> wide,
+                               ray_packet& packet,
+                               uint32_t lanes,
+                               Intersect&& intersect) const
+{
+    if (wide.empty() || lanes == 0)
+        return;
+
+    struct visit
+    {
+        uint32_t child;
+        uint16_t n_primitives;
+        // the lanes that entered the child's box
+        uint32_t lanes;
+        // where the first of them enters it
+        float t;
+    };
+
+    visit to_visit[max_depth * (N - 1) + 1];
+    int to_visit_count = 0;
+    to_visit[to_visit_count++] = { 0, 0, lanes, packet.t_min };
+    while (to_visit_count > 0) {
+        visit current = to_visit[--to_visit_count];
+        // skip children that every lane has found a closer hit than since they were pushed
+        if (current.t > packet.farthest(current.lanes))
+            continue;
+
+        if (current.n_primitives > 0) {
+            for (int i = 0; i < current.n_primitives; ++i)
+                intersect(current.child + i, current.lanes);
+            continue;
+        }
+
+        const wide_bvh_node<N>& node = wide[current.child];
+        int first = to_visit_count;
+        for (int i = 0; i < node.n_children; ++i) {
+            float t_enter;
+            uint32_t active = packet_box_test(packet,
+                                              current.lanes,
+                                              node.min_x[i],
+                                              node.min_y[i],
+                                              node.min_z[i],
+                                              node.max_x[i],
+                                              node.max_y[i],
+                                              node.max_z[i],
+                                              &t_enter);
+            if (active == 0)
+                continue;
+            // push far to near, so the nearest one is visited next
+            visit child = { node.child[i], node.n_primitives[i], active, t_enter };
+            int j = to_visit_count++;
+            while (j > first && to_visit[j - 1].t < child.t) {
+                to_visit[j] = to_visit[j - 1];
+                --j;
+            }
+            to_visit[j] = child;
+        }
+    }
+}
+
+#endif
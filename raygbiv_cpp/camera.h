@@ -55,6 +55,17 @@ class camera
                    random_float(time0, time1));
     }
 
+    // as above, with the point on the lens picked by lens_sample and the time by time_sample, both in [0,1)
+    ray get_ray(float s, float t, const vec2& lens_sample, float time_sample) const
+    {
+        vec3 rd = lens_radius * random_in_unit_disk(lens_sample);
+        vec3 offset = u * rd.x + v * rd.y;
+
+        return ray(origin + offset,
+                   lower_left_corner + s * horizontal + t * vertical - origin - offset,
+                   time0 + time_sample * (time1 - time0));
+    }
+
   private:
     point3 origin;
     point3 lower_left_corner;
@@ -0,0 +1,188 @@
+#include "checkpoint.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "mapped_file.h"
+
+namespace {
+
+// "raygbiv checkpoint", version 3. The values that follow are in the byte order of the machine that wrote them.
+const char checkpoint_magic[8] = { 'R', 'G', 'B', 'V', 'C', 'K', 'P', '3' };
+
+// the bytes the settings take: the scene hash, eight 32-bit integers and the adaptive error
+const size_t checkpoint_settings_size = sizeof(uint64_t) + 8 * sizeof(int32_t) + sizeof(float);
+
+// the bytes one pixel takes: the rgb sum, the sample count, the luminance mean and m2, and the converged flag
+const size_t checkpoint_pixel_size = 3 * sizeof(float) + sizeof(int32_t) + 2 * sizeof(float) + 1;
+
+template<class T>
+char*
+put(char* out, const T& value)
+{
+    std::memcpy(out, &value, sizeof(T));
+    return out + sizeof(T);
+}
+
+template<class T>
+const char*
+get(const char* in, T& value)
+{
+    std::memcpy(&value, in, sizeof(T));
+    return in + sizeof(T);
+}
+
+char*
+put_settings(char* out, const checkpoint_settings& settings)
+{
+    out = put(out, settings.scene_hash);
+    out = put(out, settings.image_width);
+    out = put(out, settings.image_height);
+    out = put(out, settings.samples_per_pixel);
+    out = put(out, settings.pass_samples);
+    out = put(out, settings.min_samples);
+    out = put(out, settings.max_path_size);
+    out = put(out, settings.sampler);
+    out = put(out, settings.integrator);
+    return put(out, settings.adaptive_error);
+}
+
+const char*
+get_settings(const char* in, checkpoint_settings& settings)
+{
+    in = get(in, settings.scene_hash);
+    in = get(in, settings.image_width);
+    in = get(in, settings.image_height);
+    in = get(in, settings.samples_per_pixel);
+    in = get(in, settings.pass_samples);
+    in = get(in, settings.min_samples);
+    in = get(in, settings.max_path_size);
+    in = get(in, settings.sampler);
+    in = get(in, settings.integrator);
+    return get(in, settings.adaptive_error);
+}
+
+} // namespace
+
+checkpoint_settings
+make_checkpoint_settings(uint64_t scene_hash, const render_settings& rs, int pass_samples)
+{
+    checkpoint_settings settings;
+    settings.scene_hash = scene_hash;
+    settings.image_width = rs.image_width;
+    settings.image_height = rs.image_height;
+    settings.samples_per_pixel = rs.samples_per_pixel;
+    settings.pass_samples = pass_samples;
+    settings.min_samples = rs.min_samples;
+    settings.max_path_size = rs.max_path_size;
+    settings.sampler = static_cast<int32_t>(rs.sampler);
+    settings.integrator = static_cast<int32_t>(rs.integrator);
+    settings.adaptive_error = rs.adaptive_error;
+    return settings;
+}
+
+bool
+operator==(const checkpoint_settings& a, const checkpoint_settings& b)
+{
+    return a.scene_hash == b.scene_hash && a.image_width == b.image_width && a.image_height == b.image_height &&
+           a.samples_per_pixel == b.samples_per_pixel && a.pass_samples == b.pass_samples &&
+           a.min_samples == b.min_samples && a.max_path_size == b.max_path_size && a.sampler == b.sampler &&
+           a.integrator == b.integrator && a.adaptive_error == b.adaptive_error;
+}
+
+bool
+write_checkpoint(const std::string& filename, const checkpoint_settings& settings, const accumulation_buffer& film)
+{
+    std::string temporary = filename + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        char header[sizeof(checkpoint_magic) + checkpoint_settings_size];
+        std::memcpy(header, checkpoint_magic, sizeof(checkpoint_magic));
+        put_settings(header + sizeof(checkpoint_magic), settings);
+        out.write(header, sizeof(header));
+
+        // a row at a time
+        std::vector<char> row(film.w * checkpoint_pixel_size);
+        for (int j = 0; j < film.h; ++j) {
+            char* p = row.data();
+            for (int i = 0; i < film.w; ++i) {
+                const auto& pixel = film.at(i, j);
+                p = put(p, pixel.sum.x);
+                p = put(p, pixel.sum.y);
+                p = put(p, pixel.sum.z);
+                p = put(p, static_cast<int32_t>(pixel.samples));
+                p = put(p, pixel.luminance_mean);
+                p = put(p, pixel.luminance_m2);
+                p = put(p, static_cast<uint8_t>(pixel.converged));
+            }
+            out.write(row.data(), row.size());
+        }
+        if (!out.flush())
+            return false;
+    }
+
+    return replace_file(temporary, filename);
+}
+
+bool
+read_checkpoint(const std::string& filename, const checkpoint_settings& settings, accumulation_buffer& film)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+
+    char header[sizeof(checkpoint_magic) + checkpoint_settings_size];
+    if (!in.read(header, sizeof(header)) || std::memcmp(header, checkpoint_magic, sizeof(checkpoint_magic)) != 0)
+        return false;
+    checkpoint_settings saved;
+    get_settings(header + sizeof(checkpoint_magic), saved);
+    if (!(saved == settings) || saved.image_width != film.w || saved.image_height != film.h)
+        return false;
+
+    std::vector<char> row(film.w * checkpoint_pixel_size);
+    for (int j = 0; j < film.h; ++j) {
+        if (!in.read(row.data(), row.size()))
+            return false;
+        const char* p = row.data();
+        for (int i = 0; i < film.w; ++i) {
+            auto& pixel = film.at(i, j);
+            int32_t samples;
+            uint8_t converged;
+            p = get(p, pixel.sum.x);
+            p = get(p, pixel.sum.y);
+            p = get(p, pixel.sum.z);
+            p = get(p, samples);
+            p = get(p, pixel.luminance_mean);
+            p = get(p, pixel.luminance_m2);
+            p = get(p, converged);
+            pixel.samples = samples;
+            pixel.converged = converged != 0;
+        }
+    }
+    return true;
+}
+
+bool
+checkpoint_writer::write_async(const accumulation_buffer& film)
+{
+    if (pending.valid() && pending.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return false;
+    wait();
+    // the copy is what keeps the render free to go on adding to film while it is written
+    pending = std::async(std::launch::async, [this, snapshot = film] {
+        return write_checkpoint(filename, settings, snapshot);
+    });
+    return true;
+}
+
+void
+checkpoint_writer::wait()
+{
+    if (pending.valid() && !pending.get())
+        std::cerr << "\nCould not write checkpoint " << filename << std::endl;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "image_buffer.h"
+#include "scene.h"
+
+#include <cstdint>
+#include <future>
+#include <string>
+
+// The settings a checkpoint was taken with. A render only resumes from a checkpoint with the same ones, since only
+// then do the samples it goes on to take match those an uninterrupted render would have taken.
+struct checkpoint_settings
+{
+    // content_hash of the scene file
+    uint64_t scene_hash = 0;
+    int32_t image_width = 0;
+    int32_t image_height = 0;
+    int32_t samples_per_pixel = 0;
+    int32_t pass_samples = 0;
+    int32_t min_samples = 0;
+    int32_t max_path_size = 0;
+    int32_t sampler = 0;
+    int32_t integrator = 0;
+    float adaptive_error = 0.0f;
+};
+
+checkpoint_settings
+make_checkpoint_settings(uint64_t scene_hash, const render_settings& rs, int pass_samples);
+
+bool
+operator==(const checkpoint_settings& a, const checkpoint_settings& b);
+
+// Writes the settings and every pixel of film to filename, by way of a temporary file that only replaces it once it
+// is complete, so a render killed while writing still leaves the previous checkpoint. The random numbers of a sample
+// only depend on its pixel and its index, so the sample counts in film stand for the whole state of the generators.
+bool
+write_checkpoint(const std::string& filename, const checkpoint_settings& settings, const accumulation_buffer& film);
+
+// reads a checkpoint into film; false if the file cannot be read, is not a checkpoint or was taken with other settings
+bool
+read_checkpoint(const std::string& filename, const checkpoint_settings& settings, accumulation_buffer& film);
+
+// Writes checkpoints on a thread of its own, so the render does not wait for the disk.
+class checkpoint_writer
+{
+  public:
+    checkpoint_writer(const std::string& filename, const checkpoint_settings& settings)
+      : filename(filename)
+      , settings(settings)
+    {}
+    ~checkpoint_writer() { wait(); }
+
+    // starts writing a copy of film, unless the previous checkpoint is still being written; returns whether it did
+    bool write_async(const accumulation_buffer& film);
+
+    // waits until the checkpoint being written, if any, is on disk
+    void wait();
+
+  private:
+    std::string filename;
+    checkpoint_settings settings;
+    std::future<bool> pending;
+};
+
+#endif
@@ -15,4 +15,11 @@ write_color(std::ostream& out, color pixel_color)
         << static_cast<int>(255.999 * pixel_color.z) << '\n';
 }
 
+// relative luminance of a linear rgb color (Rec. 709 primaries)
+inline float
+luminance(const color& c)
+{
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
 #endif
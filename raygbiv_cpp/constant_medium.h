@@ -12,16 +12,16 @@
 class constant_medium : public hittable
 {
   public:
-    constant_medium(shared_ptr<hittable> b, float d, shared_ptr<texture> a)
+    constant_medium(shared_ptr<hittable> b, float d, shared_ptr<texture> a, material_table& materials)
       : boundary(b)
+      , phase_function(materials.add(make_shared<isotropic>(a)))
       , neg_inv_density(-1 / d)
-      , phase_function(make_shared<isotropic>(a))
     {}
 
-    constant_medium(shared_ptr<hittable> b, float d, color c)
+    constant_medium(shared_ptr<hittable> b, float d, color c, material_table& materials)
       : boundary(b)
+      , phase_function(materials.add(make_shared<isotropic>(c)))
       , neg_inv_density(-1 / d)
-      , phase_function(make_shared<isotropic>(c))
     {}
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
@@ -33,7 +33,7 @@ class constant_medium : public hittable
 
   public:
     shared_ptr<hittable> boundary;
-    shared_ptr<material> phase_function;
+    uint32_t phase_function;
     float neg_inv_density;
 };
 
@@ -84,7 +84,7 @@ constant_medium::hit(const ray& r, float t_min, float t_max, hit_record& rec) co
 
     rec.normal = vec3(1, 0, 0); // arbitrary
     rec.front_face = true;      // also arbitrary
-    rec.mat_ptr = phase_function;
+    rec.mat_id = phase_function;
 
     return true;
 }
@@ -0,0 +1,291 @@
+#include "float_image.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// the deflate compressor built with stb_image_write.h, which gives exr files zip compression without another library
+extern "C" unsigned char*
+stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+namespace {
+
+// both formats are little endian whatever the machine writing them
+void
+put_u32(std::vector<char>& out, uint32_t x)
+{
+    for (int b = 0; b < 4; ++b)
+        out.push_back(static_cast<char>((x >> (8 * b)) & 0xff));
+}
+
+void
+put_u64(std::vector<char>& out, uint64_t x)
+{
+    for (int b = 0; b < 8; ++b)
+        out.push_back(static_cast<char>((x >> (8 * b)) & 0xff));
+}
+
+void
+put_float(std::vector<char>& out, float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    put_u32(out, x);
+}
+
+void
+put_string(std::vector<char>& out, const char* s)
+{
+    out.insert(out.end(), s, s + std::strlen(s) + 1);
+}
+
+// the nearest half, ties to even; finite values too large for a half become the largest one, so that a single
+// firefly does not turn into an infinity that spreads through whatever filters the image later
+uint16_t
+float_to_half(float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t exponent = (x >> 23) & 0xff;
+    uint32_t mantissa = x & 0x7fffff;
+
+    if (exponent == 0xff)
+        return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    int e = static_cast<int>(exponent) - 127 + 15;
+    if (e >= 31)
+        return static_cast<uint16_t>(sign | 0x7bff);
+
+    uint32_t shift;
+    uint32_t h;
+    if (e <= 0) {
+        // a subnormal half, or zero
+        if (e < -10)
+            return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000;
+        shift = 14 - e;
+        h = mantissa >> shift;
+    } else {
+        shift = 13;
+        h = (static_cast<uint32_t>(e) << 10) | (mantissa >> shift);
+    }
+    // rounding up may carry into the exponent, which is still the right answer unless it reaches infinity
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1)))
+        ++h;
+    return static_cast<uint16_t>(sign | std::min(h, 0x7bffu));
+}
+
+color
+average(const accumulated_pixel& pixel)
+{
+    return pixel.samples > 0 ? pixel.sum / static_cast<float>(pixel.samples) : color(0.0f, 0.0f, 0.0f);
+}
+
+// attribute name, type name, value size and value, as the exr header lists them
+void
+put_attribute(std::vector<char>& out, const char* name, const char* type, const std::vector<char>& value)
+{
+    put_string(out, name);
+    put_string(out, type);
+    put_u32(out, static_cast<uint32_t>(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+// The byte shuffle and delta both rle and zip compression of exr start with: the even bytes, then the odd ones, so
+// the high and low bytes of the values end up together, each stored as the difference from the byte before.
+std::vector<unsigned char>
+exr_predict(const std::vector<char>& raw)
+{
+    std::vector<unsigned char> t(raw.size());
+    size_t half = (raw.size() + 1) / 2;
+    for (size_t k = 0; k < raw.size(); ++k)
+        t[(k & 1) ? half + k / 2 : k / 2] = static_cast<unsigned char>(raw[k]);
+    for (size_t k = t.size(); k-- > 1;)
+        t[k] = static_cast<unsigned char>(t[k] - t[k - 1] + 128);
+    return t;
+}
+
+// OpenEXR's run length encoding: a count c >= 0 followed by one byte repeated c + 1 times, or a count -c < 0 followed
+// by c bytes as they are
+std::vector<char>
+exr_rle(const std::vector<unsigned char>& in)
+{
+    const size_t min_run = 3;
+    const size_t max_run = 127;
+    std::vector<char> out;
+    size_t start = 0;
+    size_t end = 1;
+    while (start < in.size()) {
+        while (end < in.size() && in[start] == in[end] && end - start - 1 < max_run)
+            ++end;
+        if (end - start >= min_run) {
+            out.push_back(static_cast<char>(end - start - 1));
+            out.push_back(static_cast<char>(in[start]));
+            start = end;
+        } else {
+            // take bytes as they are up to the next run of three
+            while (end < in.size() &&
+                   (end + 1 >= in.size() || in[end] != in[end + 1] || end + 2 >= in.size() ||
+                    in[end + 1] != in[end + 2]) &&
+                   end - start < max_run)
+                ++end;
+            out.push_back(static_cast<char>(-static_cast<int>(end - start)));
+            out.insert(out.end(), in.begin() + start, in.begin() + end);
+            start = end;
+        }
+        ++end;
+    }
+    return out;
+}
+
+std::vector<char>
+exr_zip(const std::vector<unsigned char>& in)
+{
+    int size = 0;
+    unsigned char* z = stbi_zlib_compress(const_cast<unsigned char*>(in.data()), static_cast<int>(in.size()), &size, 8);
+    if (!z)
+        return {};
+    std::vector<char> out(z, z + size);
+    std::free(z);
+    return out;
+}
+
+} // namespace
+
+bool
+write_pfm(const std::string& filename, const accumulation_buffer& film)
+{
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+    // a negative scale says the floats are little endian
+    out << "PF\n" << film.w << " " << film.h << "\n-1.0\n";
+
+    std::vector<char> row;
+    row.reserve(film.w * 3 * sizeof(float));
+    for (int j = 0; j < film.h; ++j) {
+        row.clear();
+        for (int i = 0; i < film.w; ++i) {
+            color c = average(film.at(i, j));
+            put_float(row, c.x);
+            put_float(row, c.y);
+            put_float(row, c.z);
+        }
+        out.write(row.data(), row.size());
+    }
+    return static_cast<bool>(out.flush());
+}
+
+bool
+write_exr(const std::string& filename,
+          const accumulation_buffer& film,
+          exr_pixel_type pixel_type,
+          exr_compression compression)
+{
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out)
+        return false;
+
+    // magic number, then version 2 with no flags: a single part scanline file
+    std::vector<char> header;
+    put_u32(header, 20000630);
+    put_u32(header, 2);
+
+    uint32_t type = pixel_type == exr_pixel_type::half ? 1 : 2;
+    std::vector<char> channels;
+    for (const char* name : { "B", "G", "R" }) {
+        put_string(channels, name);
+        put_u32(channels, type);
+        // not perceptually linear, and three reserved bytes
+        channels.insert(channels.end(), 4, 0);
+        put_u32(channels, 1);
+        put_u32(channels, 1);
+    }
+    channels.push_back(0);
+    put_attribute(header, "channels", "chlist", channels);
+
+    put_attribute(header, "compression", "compression", { static_cast<char>(compression) });
+
+    std::vector<char> window;
+    put_u32(window, 0);
+    put_u32(window, 0);
+    put_u32(window, film.w - 1);
+    put_u32(window, film.h - 1);
+    put_attribute(header, "dataWindow", "box2i", window);
+    put_attribute(header, "displayWindow", "box2i", window);
+    // increasing y, from the top of the image down
+    put_attribute(header, "lineOrder", "lineOrder", { 0 });
+    std::vector<char> value;
+    put_float(value, 1.0f);
+    put_attribute(header, "pixelAspectRatio", "float", value);
+    value.clear();
+    put_float(value, 0.0f);
+    put_float(value, 0.0f);
+    put_attribute(header, "screenWindowCenter", "v2f", value);
+    value.clear();
+    put_float(value, 1.0f);
+    put_attribute(header, "screenWindowWidth", "float", value);
+    header.push_back(0);
+    out.write(header.data(), header.size());
+
+    // the offset of every block goes before the blocks; it is filled in once they are written
+    int block_rows = compression == exr_compression::zip ? 16 : 1;
+    int blocks = (film.h + block_rows - 1) / block_rows;
+    auto table_position = out.tellp();
+    std::vector<char> table(blocks * sizeof(uint64_t), 0);
+    out.write(table.data(), table.size());
+
+    std::vector<uint64_t> offsets;
+    std::vector<color> colors(film.w);
+    std::vector<char> raw;
+    std::vector<char> block;
+    for (int y = 0; y < film.h; y += block_rows) {
+        // every row holds all of its B values, then its G values, then its R values
+        raw.clear();
+        for (int row = y; row < std::min(y + block_rows, film.h); ++row) {
+            // row 0 of the film is the bottom of the image
+            int j = film.h - 1 - row;
+            for (int i = 0; i < film.w; ++i)
+                colors[i] = average(film.at(i, j));
+            for (int channel = 2; channel >= 0; --channel) {
+                for (int i = 0; i < film.w; ++i) {
+                    float v = colors[i][channel];
+                    if (pixel_type == exr_pixel_type::half) {
+                        uint16_t h = float_to_half(v);
+                        raw.push_back(static_cast<char>(h & 0xff));
+                        raw.push_back(static_cast<char>(h >> 8));
+                    } else {
+                        put_float(raw, v);
+                    }
+                }
+            }
+        }
+
+        std::vector<char> packed;
+        if (compression == exr_compression::rle)
+            packed = exr_rle(exr_predict(raw));
+        else if (compression == exr_compression::zips || compression == exr_compression::zip)
+            packed = exr_zip(exr_predict(raw));
+        // a block that does not get smaller is stored as it is, which readers tell by its size
+        const std::vector<char>& data = !packed.empty() && packed.size() < raw.size() ? packed : raw;
+
+        offsets.push_back(static_cast<uint64_t>(out.tellp()));
+        block.clear();
+        put_u32(block, static_cast<uint32_t>(y));
+        put_u32(block, static_cast<uint32_t>(data.size()));
+        out.write(block.data(), block.size());
+        out.write(data.data(), data.size());
+    }
+
+    table.clear();
+    for (auto offset : offsets)
+        put_u64(table, offset);
+    out.seekp(table_position);
+    out.write(table.data(), table.size());
+    return static_cast<bool>(out.flush());
+}
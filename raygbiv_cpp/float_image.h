@@ -0,0 +1,43 @@
+#pragma once
+
+#ifndef FLOAT_IMAGE_H
+#define FLOAT_IMAGE_H
+
+#include "image_buffer.h"
+
+#include <string>
+
+// Writers for the linear, unclamped average of the samples in each pixel, for compositing and comparing renders
+// without the rounding of the 8-bit png. Both write the image a row at a time straight from the accumulation buffer.
+
+// the precision of the channels of an exr file
+enum class exr_pixel_type
+{
+    half,
+    float32
+};
+
+// how the rows of an exr file are compressed, in the order of the codes exr has for them
+enum class exr_compression
+{
+    none,
+    // run length encoding, one row at a time
+    rle,
+    // zlib, one row at a time
+    zips,
+    // zlib, 16 rows at a time
+    zip
+};
+
+// a portable float map: three 32 bit floats per pixel, little endian, the bottom row first
+bool
+write_pfm(const std::string& filename, const accumulation_buffer& film);
+
+// a single part scanline OpenEXR file with B, G and R channels
+bool
+write_exr(const std::string& filename,
+          const accumulation_buffer& film,
+          exr_pixel_type pixel_type,
+          exr_compression compression);
+
+#endif
@@ -1,157 +1,81 @@
 #include "hittable.h"
 
-bool
-translate::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
-{
-    ray moved_r(r.origin() - offset, r.direction(), r.time());
-    if (!ptr->hit(moved_r, t_min, t_max, rec))
-        return false;
-
-    rec.p += offset;
-    rec.set_face_normal(moved_r, rec.normal);
-
-    return true;
-}
+#include "ray_packet.h"
 
-bool
-translate::bounding_box(float time0, float time1, aabb& output_box) const
+void
+hittable::intersect_packet(ray_packet& packet, uint32_t lanes) const
 {
-    if (!ptr->bounding_box(time0, time1, output_box))
-        return false;
-
-    output_box = aabb(output_box.min() + offset, output_box.max() + offset);
-
-    return true;
+    hit_record rec;
+    for (int lane = 0; lanes != 0; ++lane, lanes >>= 1) {
+        if ((lanes & 1) && hit(packet.rays[lane], packet.t_min, packet.t_max[lane], rec))
+            packet.record(lane, rec);
+    }
 }
 
-rotate_y::rotate_y(shared_ptr<hittable> p, float angle)
+transform_instance::transform_instance(shared_ptr<hittable> p, const affine_transform& object_to_world)
   : ptr(p)
+  , object_to_world(object_to_world)
+  , world_to_object(object_to_world.inverse())
 {
-    auto radians = degrees_to_radians(angle);
-    sin_theta = sin(radians);
-    cos_theta = cos(radians);
     hasbox = ptr->bounding_box(0, 1, bbox);
-
-    point3 min(infinity, infinity, infinity);
-    point3 max(-infinity, -infinity, -infinity);
-
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++) {
-                auto x = i * bbox.max().x + (1 - i) * bbox.min().x;
-                auto y = j * bbox.max().y + (1 - j) * bbox.min().y;
-                auto z = k * bbox.max().z + (1 - k) * bbox.min().z;
-
-                auto newx = cos_theta * x + sin_theta * z;
-                auto newz = -sin_theta * x + cos_theta * z;
-
-                vec3 tester(newx, y, newz);
-
-                for (int c = 0; c < 3; c++) {
-                    min[c] = fmin(min[c], tester[c]);
-                    max[c] = fmax(max[c], tester[c]);
-                }
-            }
-        }
-    }
-
-    bbox = aabb(min, max);
+    if (hasbox)
+        bbox = object_to_world.box(bbox);
 }
 
 bool
-rotate_y::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+transform_instance::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-    ray rotated_r(origin, direction, r.time());
-
-    if (!ptr->hit(rotated_r, t_min, t_max, rec))
+    if (!ptr->hit(to_object(r), t_min, t_max, rec))
         return false;
 
-    auto p = rec.p;
-    auto normal = rec.normal;
-
-    p[0] = cos_theta * rec.p[0] + sin_theta * rec.p[2];
-    p[2] = -sin_theta * rec.p[0] + cos_theta * rec.p[2];
-
-    normal[0] = cos_theta * rec.normal[0] + sin_theta * rec.normal[2];
-    normal[2] = -sin_theta * rec.normal[0] + cos_theta * rec.normal[2];
-
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
-
+    to_world(rec);
     return true;
 }
 
-rotate_x::rotate_x(shared_ptr<hittable> p, float angle)
-  : ptr(p)
+void
+transform_instance::to_world(hit_record& rec) const
 {
-    auto radians = degrees_to_radians(angle);
-    sin_theta = sin(radians);
-    cos_theta = cos(radians);
-    hasbox = ptr->bounding_box(0, 1, bbox);
-
-    point3 min(infinity, infinity, infinity);
-    point3 max(-infinity, -infinity, -infinity);
-
-    for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++) {
-                auto x = i * bbox.max().x + (1 - i) * bbox.min().x;
-                auto y = j * bbox.max().y + (1 - j) * bbox.min().y;
-                auto z = k * bbox.max().z + (1 - k) * bbox.min().z;
-
-                auto newy = cos_theta * y + sin_theta * z;
-                auto newz = -sin_theta * y + cos_theta * z;
-
-                vec3 tester(x, newy, newz);
+    // the normal already faces the ray, and the transform keeps it that way
+    rec.p = object_to_world.point(rec.p);
+    vec3 normal = world_to_object.transposed_vector(rec.normal);
+    rec.normal = normal / std::sqrt(dot(normal, normal));
+}
 
-                for (int c = 0; c < 3; c++) {
-                    min[c] = fmin(min[c], tester[c]);
-                    max[c] = fmax(max[c], tester[c]);
-                }
-            }
+void
+transform_instance::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    // the lanes' rays in the space of the object; distances along them stay the same, so each keeps its t_max
+    ray_packet local;
+    local.t_min = packet.t_min;
+    for (int lane = 0; lane < ray_packet::max_width; ++lane) {
+        if ((lanes >> lane) & 1)
+            local.set_ray(lane, to_object(packet.rays[lane]), packet.t_max[lane]);
+    }
+    ptr->intersect_packet(local, lanes);
+
+    // the records have to be moved back into world space, so the ones still to be filled in are filled in here
+    local.fill_records();
+    for (int lane = 0; lane < ray_packet::max_width; ++lane) {
+        if ((local.hit_lanes >> lane) & 1) {
+            to_world(local.rec[lane]);
+            packet.record(lane, local.rec[lane]);
         }
     }
-
-    bbox = aabb(min, max);
 }
 
-bool
-rotate_x::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+void
+flip_face::intersect_packet(ray_packet& packet, uint32_t lanes) const
 {
-    auto origin = r.origin();
-    auto direction = r.direction();
-
-    origin[1] = cos_theta * r.origin()[1] - sin_theta * r.origin()[2];
-    origin[2] = sin_theta * r.origin()[1] + cos_theta * r.origin()[2];
-
-    direction[1] = cos_theta * r.direction()[1] - sin_theta * r.direction()[2];
-    direction[2] = sin_theta * r.direction()[1] + cos_theta * r.direction()[2];
-
-    ray rotated_r(origin, direction, r.time());
-
-    if (!ptr->hit(rotated_r, t_min, t_max, rec))
-        return false;
-
-    auto p = rec.p;
-    auto normal = rec.normal;
-
-    p[1] = cos_theta * rec.p[1] + sin_theta * rec.p[2];
-    p[2] = -sin_theta * rec.p[1] + cos_theta * rec.p[2];
-
-    normal[1] = cos_theta * rec.normal[1] + sin_theta * rec.normal[2];
-    normal[2] = -sin_theta * rec.normal[1] + cos_theta * rec.normal[2];
-
-    rec.p = p;
-    rec.set_face_normal(rotated_r, normal);
-
-    return true;
+    // hit_lanes is cleared for ptr, to tell the lanes it hits from the ones hit before
+    uint32_t hit_before = packet.hit_lanes;
+    packet.hit_lanes = 0;
+    ptr->intersect_packet(packet, lanes);
+    uint32_t hits = packet.hit_lanes;
+    packet.hit_lanes |= hit_before;
+    for (int lane = 0; lane < ray_packet::max_width; ++lane) {
+        if ((hits >> lane) & 1) {
+            packet.fill_record(lane);
+            packet.rec[lane].front_face = !packet.rec[lane].front_face;
+        }
+    }
 }
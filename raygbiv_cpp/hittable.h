@@ -5,23 +5,29 @@
 
 #include "aabb.h"
 #include "rtweekend.h"
+#include "transform.h"
 
-class material;
+struct ray_packet;
 
+// objects that are only sampled, such as the lights list, and never shaded
+constexpr uint32_t no_material = ~uint32_t(0);
+
+// mat_id indexes the scene's material_table, which keeps the record small and free of reference counting
 struct hit_record
 {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
     float t;
     float u;
     float v;
+    uint32_t mat_id;
     bool front_face;
 
     hit_record()
       : t(0)
       , u(0)
       , v(0)
+      , mat_id(no_material)
       , front_face(true)
     {}
 
@@ -38,58 +44,66 @@ class hittable
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const = 0;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const = 0;
 
+    // distance to the closest hit in [t_min, t_max], without any of the shading data hit() fills in
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const
+    {
+        hit_record rec;
+        if (!hit(r, t_min, t_max, rec))
+            return false;
+        t = rec.t;
+        return true;
+    }
+
+    // whether anything is hit in [t_min, t_max]; stops at the first hit found rather than the closest
+    virtual bool occluded(const ray& r, float t_min, float t_max) const
+    {
+        float t;
+        return intersect_t(r, t_min, t_max, t);
+    }
+
+    // Finds the closest hit of each of the lanes of the packet that is nearer than the lane's t_max, as hit() would,
+    // and records it in the packet. This one calls hit() a lane at a time; objects with a SIMD test override it.
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const;
+
     // evaluate the pdf of the ray from o toward v
     virtual float pdf_value(const point3& o, const vec3& v) const { return 0.0; }
 
-    // return a direction from o to a (uniform?) random point on the hittable
-    virtual vec3 random(const vec3& o) const { return vec3(1, 0, 0); }
+    // return a direction from o to a (uniform?) random point on the hittable, the point of the unit square u picking
+    // which one
+    virtual vec3 random(const vec3& o, const vec2& u) const { return vec3(1, 0, 0); }
 };
 
-class translate : public hittable
+// An object with a SIMD test in intersect_packet, which records its hits with ray_packet::record_deferred and leaves
+// their records to be filled in later by fill_hit(), once the closest hit of each lane is known.
+class deferred_hittable : public hittable
 {
   public:
-    translate(shared_ptr<hittable> p, const vec3& displacement)
-      : ptr(p)
-      , offset(displacement)
-    {}
-
-    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
-
-    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
-
-  public:
-    shared_ptr<hittable> ptr;
-    vec3 offset;
+    // Fills in rec for a hit of r at t found by the SIMD test, which also worked out the coordinates a and b of the
+    // hit on the object where it has any, so that only the shading data is left to compute.
+    virtual void fill_hit(const ray& r, float t, float a, float b, hit_record& rec) const = 0;
 };
 
-
-class rotate_y : public hittable
+// An object placed in the scene by an affine transform: rays are taken into the object's own space, so a single
+// virtual call and one matrix replace a chain of translate and rotate wrappers. The object is shared, so many
+// instances of one tree each cost only their matrices.
+class transform_instance : public hittable
 {
   public:
-    rotate_y(shared_ptr<hittable> p, float angle);
+    transform_instance(shared_ptr<hittable> p, const affine_transform& object_to_world);
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
 
-    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override
     {
-        output_box = bbox;
-        return hasbox;
+        return ptr->intersect_t(to_object(r), t_min, t_max, t);
     }
 
-  public:
-    shared_ptr<hittable> ptr;
-    float sin_theta;
-    float cos_theta;
-    bool hasbox;
-    aabb bbox;
-};
-
-class rotate_x : public hittable
-{
-  public:
-    rotate_x(shared_ptr<hittable> p, float angle);
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(to_object(r), t_min, t_max);
+    }
 
-    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
 
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
@@ -99,10 +113,20 @@ class rotate_x : public hittable
 
   public:
     shared_ptr<hittable> ptr;
-    float sin_theta;
-    float cos_theta;
+    affine_transform object_to_world;
+    affine_transform world_to_object;
     bool hasbox;
     aabb bbox;
+
+  private:
+    // the ray in the space of the object; its direction is not normalized, so distances along it stay the same
+    ray to_object(const ray& r) const
+    {
+        return ray(world_to_object.point(r.origin()), world_to_object.vector(r.direction()), r.time());
+    }
+
+    // a hit on the object, moved back into world space
+    void to_world(hit_record& rec) const;
 };
 
 class flip_face : public hittable
@@ -122,6 +146,18 @@ class flip_face : public hittable
         return true;
     }
 
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override
+    {
+        return ptr->intersect_t(r, t_min, t_max, t);
+    }
+
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override
+    {
+        return ptr->occluded(r, t_min, t_max);
+    }
+
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override
     {
         return ptr->bounding_box(time0, time1, output_box);
@@ -1,5 +1,7 @@
 #include "hittable_list.h"
 
+#include <algorithm>
+
 bool
 hittable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
 {
@@ -18,6 +20,44 @@ hittable_list::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
     return hit_anything;
 }
 
+bool
+hittable_list::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    float object_t;
+    bool hit_anything = false;
+    auto closest_so_far = t_max;
+
+    for (const auto& object : objects) {
+        if (object->intersect_t(r, t_min, closest_so_far, object_t)) {
+            hit_anything = true;
+            closest_so_far = object_t;
+        }
+    }
+
+    if (hit_anything)
+        t = closest_so_far;
+    return hit_anything;
+}
+
+bool
+hittable_list::occluded(const ray& r, float t_min, float t_max) const
+{
+    for (const auto& object : objects) {
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    }
+
+    return false;
+}
+
+void
+hittable_list::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    // each object only finds the lanes it is nearer than
+    for (const auto& object : objects)
+        object->intersect_packet(packet, lanes);
+}
+
 bool
 hittable_list::bounding_box(float time0, float time1, aabb& output_box) const
 {
@@ -57,14 +97,25 @@ hittable_list::pdf_value(const point3& o, const vec3& v) const
 }
 
 vec3
-hittable_list::random(const vec3& o) const
+hittable_list::random(const vec3& o, const vec2& u) const
+{
+    size_t object;
+    return random(o, u, object);
+}
+
+vec3
+hittable_list::random(const vec3& o, const vec2& u, size_t& object) const
 {
     // choose random object, then generate random point on object?
     auto int_size = static_cast<int>(objects.size());
+    object = 0;
     if (int_size == 0) {
         // this has got to be some kind of error.
         return vec3(0.0f, 0.0f, 1.0f);
     }
-    auto index = random_int(0, int_size - 1);
-    return objects[index]->random(o);
+    // u.x picks the object, and what is left of it once stretched back over [0,1) the point on it
+    auto scaled = u.x * int_size;
+    auto index = std::min(static_cast<int>(scaled), int_size - 1);
+    object = static_cast<size_t>(index);
+    return objects[index]->random(o, vec2(scaled - index, u.y));
 }
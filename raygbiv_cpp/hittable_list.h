@@ -22,9 +22,15 @@ class hittable_list : public hittable
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
     virtual float pdf_value(const point3& o, const vec3& v) const override;
-    virtual vec3 random(const vec3& o) const override;
+    virtual vec3 random(const vec3& o, const vec2& u) const override;
+
+    // like random(), also setting object to the index in objects of the one the direction is toward
+    vec3 random(const vec3& o, const vec2& u, size_t& object) const;
 
   public:
     std::vector<shared_ptr<hittable>> objects;
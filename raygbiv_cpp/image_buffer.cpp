@@ -2,6 +2,9 @@
 
 #include "vec3.h"
 
+#include <algorithm>
+#include <climits>
+
 imageBuffer::imageBuffer(int w, int h): w(w), h(h) {
     data = new uint8_t[w * h * 3];
 }
@@ -27,3 +30,44 @@ void imageBuffer::putPixel(int samples_per_pixel, color& pixel_color, int i, int
     data[1 + i * 3 + j * (w * 3)] = (uint8_t)ig;
     data[2 + i * 3 + j * (w * 3)] = (uint8_t)ib;
 }
+
+accumulation_buffer::accumulation_buffer(int w, int h)
+  : w(w)
+  , h(h)
+  , pixels(w * h)
+{}
+
+void
+accumulation_buffer::resolve(imageBuffer& image) const
+{
+    for (int j = 0; j < h; ++j) {
+        for (int i = 0; i < w; ++i) {
+            const auto& p = at(i, j);
+            color sum = p.sum;
+            if (p.samples > 0)
+                image.putPixel(p.samples, sum, i, j);
+            else
+                image.putPixel(1, sum, i, j);
+        }
+    }
+}
+
+int
+accumulation_buffer::fewest_samples() const
+{
+    int fewest = INT_MAX;
+    for (const auto& p : pixels) {
+        if (!p.converged)
+            fewest = std::min(fewest, p.samples);
+    }
+    return fewest;
+}
+
+std::vector<int>
+accumulation_buffer::sample_counts() const
+{
+    std::vector<int> counts(pixels.size());
+    for (size_t p = 0; p < pixels.size(); ++p)
+        counts[p] = pixels[p].samples;
+    return counts;
+}
@@ -3,6 +3,7 @@
 #include "vec3.h"
 
 #include <inttypes.h>
+#include <vector>
 
 class imageBuffer
 {
@@ -12,4 +13,42 @@ class imageBuffer
 
     int w, h;
     uint8_t* data;
-};
\ No newline at end of file
+};
+
+// What a render has gathered in one pixel so far, across all the passes over the image.
+struct accumulated_pixel
+{
+    // sum of the samples, in linear float rgb
+    color sum = color(0.0f, 0.0f, 0.0f);
+    int samples = 0;
+    // running mean and sum of squared differences from it of the samples' luminance (Welford), for adaptive sampling
+    float luminance_mean = 0.0f;
+    float luminance_m2 = 0.0f;
+    // adaptive sampling has stopped this pixel
+    bool converged = false;
+};
+
+// Float accumulation buffer the render adds its samples to. It can be resolved to an 8-bit image at any time, so a
+// render can be looked at part way through, and later samples simply add to it.
+class accumulation_buffer
+{
+  public:
+    accumulation_buffer(int w, int h);
+
+    accumulated_pixel& at(int i, int j) { return pixels[i + j * w]; }
+    const accumulated_pixel& at(int i, int j) const { return pixels[i + j * w]; }
+
+    // the average of the samples in each pixel, gamma-corrected into image; pixels without samples are black
+    void resolve(imageBuffer& image) const;
+
+    // the fewest samples taken in any pixel adaptive sampling has not stopped, or INT_MAX if it stopped them all
+    int fewest_samples() const;
+
+    // samples taken in each pixel, row by row
+    std::vector<int> sample_counts() const;
+
+    int w, h;
+
+  private:
+    std::vector<accumulated_pixel> pixels;
+};
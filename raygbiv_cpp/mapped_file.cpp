@@ -0,0 +1,108 @@
+#include "mapped_file.h"
+
+#include <filesystem>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+std::shared_ptr<const mapped_file>
+mapped_file::open(const std::string& filename)
+{
+    HANDLE file = CreateFileA(filename.c_str(),
+                              GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_DELETE,
+                              nullptr,
+                              OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    // the view keeps the file open, so the handles can go once it is made
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (mapping == nullptr)
+        return nullptr;
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        return nullptr;
+    }
+
+    std::shared_ptr<mapped_file> mapped(new mapped_file());
+    mapped->bytes = static_cast<const char*>(view);
+    mapped->length = static_cast<size_t>(size.QuadPart);
+    mapped->mapping = mapping;
+    return mapped;
+}
+
+mapped_file::~mapped_file()
+{
+    if (bytes != nullptr)
+        UnmapViewOfFile(bytes);
+    if (mapping != nullptr)
+        CloseHandle(mapping);
+}
+
+#else
+
+std::shared_ptr<const mapped_file>
+mapped_file::open(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+    // the mapping keeps the file open, so the descriptor can go once it is made
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return nullptr;
+
+    std::shared_ptr<mapped_file> mapped(new mapped_file());
+    mapped->bytes = static_cast<const char*>(view);
+    mapped->length = static_cast<size_t>(status.st_size);
+    return mapped;
+}
+
+mapped_file::~mapped_file()
+{
+    if (bytes != nullptr)
+        munmap(const_cast<char*>(bytes), length);
+}
+
+#endif
+
+bool
+replace_file(const std::string& from, const std::string& to)
+{
+    // unlike std::rename, this replaces an existing file on Windows too, where it is MoveFileEx with
+    // MOVEFILE_REPLACE_EXISTING
+    std::error_code error;
+    std::filesystem::rename(from, to, error);
+    return !error;
+}
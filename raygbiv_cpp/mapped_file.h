@@ -0,0 +1,42 @@
+#pragma once
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// A whole file mapped read only into memory. Its pages are only read from disk when they are first touched, and stay
+// shared with the operating system's file cache, so large arrays in it can be used where they are without copying.
+class mapped_file
+{
+  public:
+    // maps filename; nullptr if it cannot be opened or mapped, or is empty
+    static std::shared_ptr<const mapped_file> open(const std::string& filename);
+
+    ~mapped_file();
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    // the start of the file; the mapping is page aligned
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+  private:
+    mapped_file() {}
+
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* mapping = nullptr;
+#endif
+};
+
+// Moves the file at from over the one at to in a single step, so that to is always either the old file or the new one,
+// even if the program is killed; false if it cannot. Files written in full under a temporary name and then moved
+// into place with this are never seen half written.
+bool
+replace_file(const std::string& from, const std::string& to);
+
+#endif
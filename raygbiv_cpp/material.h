@@ -8,6 +8,8 @@
 #include "rtweekend.h"
 #include "texture.h"
 
+#include <vector>
+
 struct hit_record;
 
 struct scatter_record
@@ -15,7 +17,8 @@ struct scatter_record
     ray specular_ray;
     bool is_specular;
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    // only used when the scatter is not specular
+    pdf scatter_pdf;
 
     scatter_record()
       : is_specular(false)
@@ -48,7 +51,7 @@ class lambertian : public material
     {
         srec.is_specular = false;
         srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.scatter_pdf = cosine_pdf(rec.normal);
         return true;
     }
 
@@ -76,7 +79,6 @@ class metal : public material
         srec.specular_ray = ray(rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time());
         srec.attenuation = albedo;
         srec.is_specular = true;
-        srec.pdf_ptr = 0;
         return true;
     }
 
@@ -95,7 +97,6 @@ class dielectric : public material
     virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
     {
         srec.is_specular = true;
-        srec.pdf_ptr = nullptr;
         srec.attenuation = color(1.0, 1.0, 1.0);
 
         float refraction_ratio = rec.front_face ? (1.0f / ir) : ir;
@@ -176,4 +177,24 @@ class isotropic : public material
     shared_ptr<texture> albedo;
 };
 
+// All the materials of a scene.  Objects keep the index of their material in the table rather than a pointer to it,
+// and the index is what ends up in a hit_record.
+class material_table
+{
+  public:
+    uint32_t add(shared_ptr<material> m)
+    {
+        materials.push_back(m);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    const material& operator[](uint32_t id) const { return *materials[id]; }
+
+    size_t size() const { return materials.size(); }
+    void clear() { materials.clear(); }
+
+  private:
+    std::vector<shared_ptr<material>> materials;
+};
+
 #endif
@@ -0,0 +1,310 @@
+#include "mesh_cache.h"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "mapped_file.h"
+#include "mesh_loader.h"
+
+namespace {
+
+// "raygbiv mesh cache", version 1
+const char mesh_cache_magic[8] = { 'R', 'G', 'B', 'V', 'M', 'S', 'H', '1' };
+
+// every array starts at a multiple of this, which covers the alignment of the wide nodes and keeps each array on
+// cache lines of its own
+const uint64_t mesh_cache_alignment = 64;
+
+// the arrays, in the order of their offsets
+enum mesh_cache_array
+{
+    cache_x,
+    cache_y,
+    cache_z,
+    cache_nx,
+    cache_ny,
+    cache_nz,
+    cache_u,
+    cache_v,
+    cache_indices,
+    cache_nodes,
+    cache_arrays
+};
+
+struct mesh_cache_header
+{
+    char magic[8];
+    // 0x01020304 as the machine that wrote the file stores it, which has to be how the one reading it does
+    uint32_t byte_order;
+    uint32_t header_size;
+    uint64_t source_hash;
+    uint64_t source_size;
+    // what the tree was built with
+    int32_t split_method;
+    int32_t sah_bins;
+    int32_t max_leaf_size;
+    int32_t width;
+    uint64_t vertex_count;
+    uint64_t triangle_count;
+    uint32_t has_normals;
+    uint32_t has_uvs;
+    // of the width the tree was built with
+    uint64_t node_count;
+    uint64_t leaf_count;
+    int32_t depth;
+    float cost;
+    float box_min[3];
+    float box_max[3];
+    // where each array starts, from the start of the file
+    uint64_t offsets[cache_arrays];
+};
+
+const uint32_t native_byte_order = 0x01020304;
+
+size_t
+node_size(int width)
+{
+    return width == 8 ? sizeof(bvh8_node) : width == 4 ? sizeof(bvh4_node) : sizeof(linear_bvh_node);
+}
+
+// the bytes each array takes in a mesh of the header's size and kind
+void
+array_sizes(const mesh_cache_header& header, uint64_t* sizes)
+{
+    uint64_t vertices = header.vertex_count * sizeof(float);
+    for (int a = cache_x; a <= cache_z; ++a) {
+        sizes[a] = vertices;
+    }
+    for (int a = cache_nx; a <= cache_nz; ++a) {
+        sizes[a] = header.has_normals ? vertices : 0;
+    }
+    sizes[cache_u] = sizes[cache_v] = header.has_uvs ? vertices : 0;
+    sizes[cache_indices] = 3 * header.triangle_count * sizeof(uint32_t);
+    sizes[cache_nodes] = header.node_count * node_size(header.width);
+}
+
+bool
+same_options(const mesh_cache_header& header, const bvh_build_options& options)
+{
+    int width = options.width >= 8 ? 8 : options.width >= 4 ? 4 : 2;
+    return header.split_method == static_cast<int32_t>(options.split_method) && header.sah_bins == options.sah_bins &&
+           header.max_leaf_size == options.max_leaf_size && header.width == width;
+}
+
+} // namespace
+
+uint64_t
+content_hash(const char* data, size_t size)
+{
+    // the rounds of xxHash64, four independent lanes of 8 bytes each, which keeps the hash close to memory speed
+    const uint64_t p1 = 0x9e3779b185ebca87ull;
+    const uint64_t p2 = 0xc2b2ae3d27d4eb4full;
+    const uint64_t p3 = 0x165667b19e3779f9ull;
+    auto rotate = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto round = [&](uint64_t lane, uint64_t word) { return rotate(lane + word * p2, 31) * p1; };
+
+    uint64_t lanes[4] = { p1 + p2, p2, 0, 0 - p1 };
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        for (int k = 0; k < 4; ++k) {
+            uint64_t word;
+            std::memcpy(&word, data + i + 8 * k, sizeof(word));
+            lanes[k] = round(lanes[k], word);
+        }
+    }
+    uint64_t h = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18) + size;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        h = rotate(h ^ round(0, word), 27) * p1 + p3;
+    }
+    for (; i < size; ++i) {
+        h = rotate(h ^ (static_cast<uint8_t>(data[i]) * p3), 11) * p1;
+    }
+    h ^= h >> 33;
+    h *= p2;
+    h ^= h >> 29;
+    h *= p3;
+    h ^= h >> 32;
+    return h;
+}
+
+bool
+write_mesh_cache(const std::string& filename,
+                 const triangle_mesh& mesh,
+                 uint64_t source_hash,
+                 uint64_t source_size,
+                 const bvh_build_options& options)
+{
+    const auto& geometry = mesh.geometry;
+    mesh_cache_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, mesh_cache_magic, sizeof(header.magic));
+    header.byte_order = native_byte_order;
+    header.header_size = sizeof(header);
+    header.source_hash = source_hash;
+    header.source_size = source_size;
+    header.split_method = static_cast<int32_t>(options.split_method);
+    header.sah_bins = options.sah_bins;
+    header.max_leaf_size = options.max_leaf_size;
+    header.width = mesh.stats.width;
+    header.vertex_count = geometry.vertex_count();
+    header.triangle_count = geometry.triangle_count();
+    header.has_normals = geometry.has_normals();
+    header.has_uvs = geometry.has_uvs();
+    header.leaf_count = mesh.stats.leaves;
+    header.depth = mesh.stats.depth;
+    header.cost = mesh.cost;
+    for (int a = 0; a < 3; ++a) {
+        header.box_min[a] = mesh.box.minimum[a];
+        header.box_max[a] = mesh.box.maximum[a];
+    }
+
+    const void* arrays[cache_arrays] = { geometry.x.data,  geometry.y.data,  geometry.z.data,
+                                         geometry.nx.data, geometry.ny.data, geometry.nz.data,
+                                         geometry.u.data,  geometry.v.data,  geometry.indices.data };
+    if (!mesh.nodes8.empty() || !mesh.mapped_nodes8.empty()) {
+        header.node_count = mesh.nodes8.empty() ? mesh.mapped_nodes8.size : mesh.nodes8.size();
+        arrays[cache_nodes] = mesh.nodes8.empty() ? mesh.mapped_nodes8.data : mesh.nodes8.data();
+    } else if (!mesh.nodes4.empty() || !mesh.mapped_nodes4.empty()) {
+        header.node_count = mesh.nodes4.empty() ? mesh.mapped_nodes4.size : mesh.nodes4.size();
+        arrays[cache_nodes] = mesh.nodes4.empty() ? mesh.mapped_nodes4.data : mesh.nodes4.data();
+    } else {
+        header.node_count = mesh.nodes.empty() ? mesh.mapped_nodes.size : mesh.nodes.size();
+        arrays[cache_nodes] = mesh.nodes.empty() ? mesh.mapped_nodes.data : mesh.nodes.data();
+    }
+
+    uint64_t sizes[cache_arrays];
+    array_sizes(header, sizes);
+    uint64_t offset = sizeof(header);
+    for (int a = 0; a < cache_arrays; ++a) {
+        offset = (offset + mesh_cache_alignment - 1) / mesh_cache_alignment * mesh_cache_alignment;
+        header.offsets[a] = offset;
+        offset += sizes[a];
+    }
+
+    std::string temporary = filename + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        const char padding[mesh_cache_alignment] = {};
+        uint64_t written = sizeof(header);
+        for (int a = 0; a < cache_arrays; ++a) {
+            out.write(padding, header.offsets[a] - written);
+            out.write(static_cast<const char*>(arrays[a]), sizes[a]);
+            written = header.offsets[a] + sizes[a];
+        }
+        if (!out.flush())
+            return false;
+    }
+
+    return replace_file(temporary, filename);
+}
+
+shared_ptr<triangle_mesh>
+map_mesh_cache(const std::string& filename,
+               uint64_t source_hash,
+               uint64_t source_size,
+               const bvh_build_options& options,
+               uint32_t mat_id)
+{
+    auto file = mapped_file::open(filename);
+    if (!file || file->size() < sizeof(mesh_cache_header))
+        return nullptr;
+
+    mesh_cache_header header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, mesh_cache_magic, sizeof(header.magic)) != 0 ||
+        header.byte_order != native_byte_order || header.header_size != sizeof(header) ||
+        header.source_hash != source_hash || header.source_size != source_size || !same_options(header, options))
+        return nullptr;
+
+    // the arrays have to be whole and where they can be used as they are
+    uint64_t sizes[cache_arrays];
+    array_sizes(header, sizes);
+    for (int a = 0; a < cache_arrays; ++a) {
+        if (header.offsets[a] % mesh_cache_alignment != 0 || header.offsets[a] > file->size() ||
+            sizes[a] > file->size() - header.offsets[a])
+            return nullptr;
+    }
+
+    auto floats = [&](int a) {
+        return array_view<float>(reinterpret_cast<const float*>(file->data() + header.offsets[a]),
+                                 sizes[a] / sizeof(float));
+    };
+    mesh_view geometry;
+    geometry.x = floats(cache_x);
+    geometry.y = floats(cache_y);
+    geometry.z = floats(cache_z);
+    geometry.nx = floats(cache_nx);
+    geometry.ny = floats(cache_ny);
+    geometry.nz = floats(cache_nz);
+    geometry.u = floats(cache_u);
+    geometry.v = floats(cache_v);
+    geometry.indices = array_view<uint32_t>(
+      reinterpret_cast<const uint32_t*>(file->data() + header.offsets[cache_indices]), 3 * header.triangle_count);
+
+    const char* nodes = file->data() + header.offsets[cache_nodes];
+    auto mesh = make_shared<triangle_mesh>(file, geometry, mat_id);
+    if (header.width == 8)
+        mesh->mapped_nodes8 = array_view<bvh8_node>(reinterpret_cast<const bvh8_node*>(nodes), header.node_count);
+    else if (header.width == 4)
+        mesh->mapped_nodes4 = array_view<bvh4_node>(reinterpret_cast<const bvh4_node*>(nodes), header.node_count);
+    else
+        mesh->mapped_nodes =
+          array_view<linear_bvh_node>(reinterpret_cast<const linear_bvh_node*>(nodes), header.node_count);
+    mesh->box = aabb(point3(header.box_min[0], header.box_min[1], header.box_min[2]),
+                     point3(header.box_max[0], header.box_max[1], header.box_max[2]));
+    mesh->cost = header.cost;
+    mesh->stats.nodes = header.node_count;
+    mesh->stats.leaves = header.leaf_count;
+    mesh->stats.depth = header.depth;
+    mesh->stats.width = header.width;
+    mesh->stats.build_ms = 0.0f;
+    return mesh;
+}
+
+shared_ptr<triangle_mesh>
+load_mesh_cached(const std::string& filename, uint32_t mat_id, const bvh_build_options& options)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+    auto milliseconds_since = [](std::chrono::high_resolution_clock::time_point from) {
+        return std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - from).count();
+    };
+
+    uint64_t source_hash, source_size;
+    {
+        auto source = mapped_file::open(filename);
+        if (!source) {
+            std::cerr << "Could not read " << filename << std::endl;
+            return nullptr;
+        }
+        source_hash = content_hash(source->data(), source->size());
+        source_size = source->size();
+    }
+
+    std::string cache_file = filename + ".cache";
+    if (auto mesh = map_mesh_cache(cache_file, source_hash, source_size, options, mat_id)) {
+        std::cerr << "Mesh " << filename << ": " << mesh->geometry.triangle_count() << " triangles, "
+                  << mesh->geometry.vertex_count() << " vertices, mapped from " << cache_file << " in "
+                  << milliseconds_since(start) << " ms" << std::endl;
+        return mesh;
+    }
+
+    mesh_buffers buffers;
+    if (!load_mesh(filename, buffers))
+        return nullptr;
+    float read_ms = milliseconds_since(start);
+    auto mesh = make_shared<triangle_mesh>(std::move(buffers), mat_id, options);
+    std::cerr << "Mesh " << filename << ": " << mesh->geometry.triangle_count() << " triangles, "
+              << mesh->geometry.vertex_count() << " vertices, read in " << read_ms << " ms, tree built in "
+              << mesh->stats.build_ms << " ms" << std::endl;
+
+    if (!write_mesh_cache(cache_file, *mesh, source_hash, source_size, options))
+        std::cerr << "Could not write mesh cache " << cache_file << std::endl;
+    return mesh;
+}
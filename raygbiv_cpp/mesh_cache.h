@@ -0,0 +1,43 @@
+#pragma once
+
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <string>
+
+// A binary cache of a triangle mesh and its tree, mapped back into memory and used where it lies instead of parsing
+// the source file and building the tree again. Every array is stored in the machine's own byte order and layout, at a
+// 64 byte aligned offset, behind a header with the version of the format, the hash and size of the contents of the
+// source file and the options the tree was built with. A cache that differs in any of those is ignored.
+
+// a 64 bit hash of the bytes, to tell whether a source file has changed
+uint64_t
+content_hash(const char* data, size_t size);
+
+// writes mesh and its tree to filename, by way of a temporary file that only replaces it once it is complete
+bool
+write_mesh_cache(const std::string& filename,
+                 const triangle_mesh& mesh,
+                 uint64_t source_hash,
+                 uint64_t source_size,
+                 const bvh_build_options& options);
+
+// maps the cache in filename as a mesh; nullptr if there is none, or it is of another version or another source, or
+// its tree was built with other options
+shared_ptr<triangle_mesh>
+map_mesh_cache(const std::string& filename,
+               uint64_t source_hash,
+               uint64_t source_size,
+               const bvh_build_options& options,
+               uint32_t mat_id);
+
+// Loads the mesh in filename from the cache beside it, filename + ".cache", if that was made from the same contents
+// with the same options. Otherwise loads it with load_mesh, builds its tree and writes the cache for the next time.
+// nullptr if the mesh cannot be loaded.
+shared_ptr<triangle_mesh>
+load_mesh_cached(const std::string& filename, uint32_t mat_id, const bvh_build_options& options);
+
+#endif
@@ -0,0 +1,564 @@
+#include "mesh_loader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "text_parse.h"
+
+namespace {
+
+const uint32_t no_index = ~uint32_t(0);
+
+bool
+is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char*
+skip_blanks(const char* p)
+{
+    while (is_blank(*p))
+        ++p;
+    return p;
+}
+
+// an OBJ index, 1 based or counting back from the last one defined, as a 0 based one
+bool
+resolve_obj_index(long long index, size_t defined, uint32_t& resolved)
+{
+    if (index > 0)
+        index -= 1;
+    else if (index < 0)
+        index += static_cast<long long>(defined);
+    else
+        return false;
+    if (index < 0 || index >= no_index)
+        return false;
+    resolved = static_cast<uint32_t>(index);
+    return true;
+}
+
+bool
+has_extension(const std::string& name, const std::string& extension)
+{
+    if (name.size() < extension.size())
+        return false;
+    return std::equal(extension.begin(), extension.end(), name.end() - extension.size(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+enum class ply_type
+{
+    int8,
+    uint8,
+    int16,
+    uint16,
+    int32,
+    uint32,
+    float32,
+    float64
+};
+
+struct ply_property
+{
+    std::string name;
+    ply_type type = ply_type::float32;
+    // a list has a count of type count_type, and then that many values of type type
+    bool list = false;
+    ply_type count_type = ply_type::uint8;
+};
+
+struct ply_element
+{
+    std::string name;
+    size_t count = 0;
+    std::vector<ply_property> properties;
+};
+
+bool
+parse_ply_type(const std::string& name, ply_type& type)
+{
+    static const std::pair<const char*, ply_type> names[] = {
+        { "char", ply_type::int8 },      { "int8", ply_type::int8 },       { "uchar", ply_type::uint8 },
+        { "uint8", ply_type::uint8 },    { "short", ply_type::int16 },     { "int16", ply_type::int16 },
+        { "ushort", ply_type::uint16 },  { "uint16", ply_type::uint16 },   { "int", ply_type::int32 },
+        { "int32", ply_type::int32 },    { "uint", ply_type::uint32 },     { "uint32", ply_type::uint32 },
+        { "float", ply_type::float32 },  { "float32", ply_type::float32 }, { "double", ply_type::float64 },
+        { "float64", ply_type::float64 }
+    };
+    for (const auto& n : names) {
+        if (name == n.first) {
+            type = n.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t
+ply_size(ply_type type)
+{
+    switch (type) {
+        case ply_type::int8:
+        case ply_type::uint8:
+            return 1;
+        case ply_type::int16:
+        case ply_type::uint16:
+            return 2;
+        case ply_type::int32:
+        case ply_type::uint32:
+        case ply_type::float32:
+            return 4;
+        case ply_type::float64:
+        default:
+            return 8;
+    }
+}
+
+// reads one value of the given type, swapping its bytes if the file's byte order is not the machine's
+double
+read_ply_value(const char* p, ply_type type, bool swap)
+{
+    char bytes[8];
+    size_t size = ply_size(type);
+    std::memcpy(bytes, p, size);
+    if (swap)
+        std::reverse(bytes, bytes + size);
+    switch (type) {
+        case ply_type::int8:
+            return static_cast<int8_t>(bytes[0]);
+        case ply_type::uint8:
+            return static_cast<uint8_t>(bytes[0]);
+        case ply_type::int16: {
+            int16_t v;
+            std::memcpy(&v, bytes, 2);
+            return v;
+        }
+        case ply_type::uint16: {
+            uint16_t v;
+            std::memcpy(&v, bytes, 2);
+            return v;
+        }
+        case ply_type::int32: {
+            int32_t v;
+            std::memcpy(&v, bytes, 4);
+            return v;
+        }
+        case ply_type::uint32: {
+            uint32_t v;
+            std::memcpy(&v, bytes, 4);
+            return v;
+        }
+        case ply_type::float32: {
+            float v;
+            std::memcpy(&v, bytes, 4);
+            return v;
+        }
+        case ply_type::float64:
+        default: {
+            double v;
+            std::memcpy(&v, bytes, 8);
+            return v;
+        }
+    }
+}
+
+} // namespace
+
+bool
+load_obj(const std::string& filename, mesh_buffers& mesh)
+{
+    std::vector<char> data;
+    if (!read_file(filename, data)) {
+        std::cerr << "Could not read " << filename << std::endl;
+        return false;
+    }
+
+    std::vector<float> px, py, pz;
+    std::vector<float> tu, tv;
+    std::vector<float> nx, ny, nz;
+
+    // A vertex of the mesh for every distinct position, uv and normal triple the faces use. The vertices sharing a
+    // position are chained from first_at_position, and there are seldom more than a few of them.
+    struct obj_vertex
+    {
+        uint32_t position, uv, normal, next;
+    };
+    std::vector<obj_vertex> vertices;
+    std::vector<uint32_t> first_at_position;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> face;
+
+    auto error = [&](int line, const char* what) {
+        std::cerr << filename << ":" << line << ": " << what << std::endl;
+        return false;
+    };
+
+    const char* p = data.data();
+    const char* end = data.data() + data.size() - 1;
+    for (int line = 1; p < end; ++line) {
+        p = skip_blanks(p);
+        if (p[0] == 'v' && is_blank(p[1])) {
+            float x, y, z;
+            if (!(p = parse_float(skip_blanks(p + 1), x)) || !(p = parse_float(skip_blanks(p), y)) ||
+                !(p = parse_float(skip_blanks(p), z)))
+                return error(line, "expected a position");
+            px.push_back(x);
+            py.push_back(y);
+            pz.push_back(z);
+        } else if (p[0] == 'v' && p[1] == 't' && is_blank(p[2])) {
+            float u, v = 0.0f;
+            if (!(p = parse_float(skip_blanks(p + 2), u)))
+                return error(line, "expected a texture coordinate");
+            const char* q = skip_blanks(p);
+            if (*q != '\n' && *q != 0 && *q != '#' && !(p = parse_float(q, v)))
+                return error(line, "expected a texture coordinate");
+            tu.push_back(u);
+            tv.push_back(v);
+        } else if (p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+            float x, y, z;
+            if (!(p = parse_float(skip_blanks(p + 2), x)) || !(p = parse_float(skip_blanks(p), y)) ||
+                !(p = parse_float(skip_blanks(p), z)))
+                return error(line, "expected a normal");
+            nx.push_back(x);
+            ny.push_back(y);
+            nz.push_back(z);
+        } else if (p[0] == 'f' && is_blank(p[1])) {
+            face.clear();
+            p = skip_blanks(p + 1);
+            while (*p != '\n' && *p != 0 && *p != '#') {
+                long long index;
+                uint32_t position, uv = no_index, normal = no_index;
+                if (!(p = parse_int(p, index)) || !resolve_obj_index(index, px.size(), position))
+                    return error(line, "bad position index");
+                if (*p == '/') {
+                    ++p;
+                    if (*p != '/' && (!(p = parse_int(p, index)) || !resolve_obj_index(index, tu.size(), uv)))
+                        return error(line, "bad texture coordinate index");
+                    if (*p == '/') {
+                        ++p;
+                        if (!(p = parse_int(p, index)) || !resolve_obj_index(index, nx.size(), normal))
+                            return error(line, "bad normal index");
+                    }
+                }
+                if (!is_blank(*p) && *p != '\n' && *p != 0)
+                    return error(line, "bad face corner");
+                p = skip_blanks(p);
+
+                if (position >= first_at_position.size())
+                    first_at_position.resize(position + 1, no_index);
+                uint32_t vertex = first_at_position[position];
+                while (vertex != no_index && (vertices[vertex].uv != uv || vertices[vertex].normal != normal))
+                    vertex = vertices[vertex].next;
+                if (vertex == no_index) {
+                    vertex = static_cast<uint32_t>(vertices.size());
+                    vertices.push_back({ position, uv, normal, first_at_position[position] });
+                    first_at_position[position] = vertex;
+                }
+                face.push_back(vertex);
+            }
+            if (face.size() < 3)
+                return error(line, "face with fewer than three corners");
+            for (size_t k = 1; k + 1 < face.size(); ++k) {
+                indices.push_back(face[0]);
+                indices.push_back(face[k]);
+                indices.push_back(face[k + 1]);
+            }
+        }
+        while (*p != '\n' && p < end)
+            ++p;
+        ++p;
+    }
+
+    bool any_uvs = false;
+    bool any_normals = false;
+    for (const auto& vertex : vertices) {
+        // indices are only checked here, as files may refer to values defined further down
+        if (vertex.position >= px.size() || (vertex.uv != no_index && vertex.uv >= tu.size()) ||
+            (vertex.normal != no_index && vertex.normal >= nx.size())) {
+            std::cerr << filename << ": a face refers to a value that is not in the file" << std::endl;
+            return false;
+        }
+        any_uvs |= vertex.uv != no_index;
+        any_normals |= vertex.normal != no_index;
+    }
+
+    // corners without a uv or normal get zeros, which the mesh takes for the triangle's own
+    size_t n = vertices.size();
+    mesh = mesh_buffers();
+    mesh.x.resize(n);
+    mesh.y.resize(n);
+    mesh.z.resize(n);
+    if (any_normals) {
+        mesh.nx.resize(n);
+        mesh.ny.resize(n);
+        mesh.nz.resize(n);
+    }
+    if (any_uvs) {
+        mesh.u.resize(n);
+        mesh.v.resize(n);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const auto& vertex = vertices[i];
+        mesh.x[i] = px[vertex.position];
+        mesh.y[i] = py[vertex.position];
+        mesh.z[i] = pz[vertex.position];
+        if (any_normals && vertex.normal != no_index) {
+            mesh.nx[i] = nx[vertex.normal];
+            mesh.ny[i] = ny[vertex.normal];
+            mesh.nz[i] = nz[vertex.normal];
+        }
+        if (any_uvs && vertex.uv != no_index) {
+            mesh.u[i] = tu[vertex.uv];
+            mesh.v[i] = tv[vertex.uv];
+        }
+    }
+    mesh.indices = std::move(indices);
+    return true;
+}
+
+bool
+load_ply(const std::string& filename, mesh_buffers& mesh)
+{
+    std::vector<char> data;
+    if (!read_file(filename, data)) {
+        std::cerr << "Could not read " << filename << std::endl;
+        return false;
+    }
+    auto error = [&](const std::string& what) {
+        std::cerr << filename << ": " << what << std::endl;
+        return false;
+    };
+
+    // the header is text, one line at a time up to end_header
+    const char* p = data.data();
+    const char* end = data.data() + data.size() - 1;
+    std::vector<ply_element> elements;
+    std::string format;
+    bool header_ended = false;
+    for (int line = 0; p < end && !header_ended; ++line) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (eol == nullptr)
+            return error("the header does not end");
+        std::istringstream words(std::string(p, eol));
+        p = eol + 1;
+        std::string keyword;
+        words >> keyword;
+        if (line == 0) {
+            if (keyword != "ply")
+                return error("not a PLY file");
+        } else if (keyword == "format") {
+            words >> format;
+        } else if (keyword == "element") {
+            ply_element element;
+            words >> element.name >> element.count;
+            if (!words)
+                return error("bad element in the header");
+            elements.push_back(element);
+        } else if (keyword == "property") {
+            ply_property property;
+            std::string type;
+            words >> type;
+            if (type == "list") {
+                std::string count_type;
+                words >> count_type >> type;
+                property.list = true;
+                if (!parse_ply_type(count_type, property.count_type))
+                    return error("unknown PLY type " + count_type);
+            }
+            words >> property.name;
+            if (!words || elements.empty())
+                return error("bad property in the header");
+            if (!parse_ply_type(type, property.type))
+                return error("unknown PLY type " + type);
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            header_ended = true;
+        }
+    }
+    if (!header_ended)
+        return error("the header does not end");
+
+    const uint16_t one = 1;
+    bool little_endian_host = *reinterpret_cast<const uint8_t*>(&one) == 1;
+    bool swap;
+    if (format == "binary_little_endian")
+        swap = !little_endian_host;
+    else if (format == "binary_big_endian")
+        swap = little_endian_host;
+    else
+        return error("only binary PLY files are supported, not " + format);
+
+    mesh = mesh_buffers();
+    bool have_vertices = false;
+    for (const auto& element : elements) {
+        // where each property of interest is in a row, if the row has a fixed size
+        bool fixed_size = true;
+        size_t row_size = 0;
+        for (const auto& property : element.properties) {
+            fixed_size &= !property.list;
+            row_size += ply_size(property.type);
+        }
+
+        if (element.name == "vertex") {
+            if (!fixed_size)
+                return error("list properties on vertices are not supported");
+            if (static_cast<size_t>(end - p) / std::max<size_t>(row_size, 1) < element.count)
+                return error("the file ends before the last vertex");
+
+            // the coordinates, in the order of mesh_buffers
+            const char* names[8][4] = { { "x" },
+                                        { "y" },
+                                        { "z" },
+                                        { "nx" },
+                                        { "ny" },
+                                        { "nz" },
+                                        { "u", "s", "texture_u", "texture_s" },
+                                        { "v", "t", "texture_v", "texture_t" } };
+            int found[8];
+            size_t offset[8] = {};
+            for (int c = 0; c < 8; ++c) {
+                found[c] = -1;
+                size_t position = 0;
+                for (size_t k = 0; k < element.properties.size(); ++k) {
+                    for (const char* name : names[c]) {
+                        if (name != nullptr && element.properties[k].name == name && found[c] < 0) {
+                            found[c] = static_cast<int>(k);
+                            offset[c] = position;
+                        }
+                    }
+                    position += ply_size(element.properties[k].type);
+                }
+            }
+            if (found[0] < 0 || found[1] < 0 || found[2] < 0)
+                return error("vertices without x, y and z");
+            bool normals = found[3] >= 0 && found[4] >= 0 && found[5] >= 0;
+            bool uvs = found[6] >= 0 && found[7] >= 0;
+
+            std::vector<float>* columns[8] = { &mesh.x,  &mesh.y,  &mesh.z, &mesh.nx,
+                                               &mesh.ny, &mesh.nz, &mesh.u, &mesh.v };
+            for (int c = 0; c < 8; ++c) {
+                if (c < 3 || (c < 6 && normals) || (c >= 6 && uvs))
+                    columns[c]->resize(element.count);
+                else
+                    found[c] = -1;
+            }
+            for (int c = 0; c < 8; ++c) {
+                if (found[c] < 0)
+                    continue;
+                auto type = element.properties[found[c]].type;
+                auto& column = *columns[c];
+                const char* row = p + offset[c];
+                if (type == ply_type::float32 && !swap) {
+                    for (size_t i = 0; i < element.count; ++i, row += row_size) {
+                        std::memcpy(&column[i], row, sizeof(float));
+                    }
+                } else {
+                    for (size_t i = 0; i < element.count; ++i, row += row_size) {
+                        column[i] = static_cast<float>(read_ply_value(row, type, swap));
+                    }
+                }
+            }
+            p += row_size * element.count;
+            have_vertices = true;
+        } else if (element.name == "face") {
+            if (!have_vertices)
+                return error("faces before the vertices");
+            const ply_property* vertex_list = nullptr;
+            for (const auto& property : element.properties) {
+                if (property.list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+                    vertex_list = &property;
+            }
+            if (vertex_list == nullptr)
+                return error("faces without vertex_indices");
+            // indices that can be copied as they are, as in most files
+            bool raw_indices =
+              !swap && (vertex_list->type == ply_type::int32 || vertex_list->type == ply_type::uint32);
+            auto vertex_count = static_cast<uint32_t>(mesh.vertex_count());
+
+            mesh.indices.reserve(3 * element.count);
+            std::vector<uint32_t> face;
+            for (size_t i = 0; i < element.count; ++i) {
+                for (const auto& property : element.properties) {
+                    size_t value_size = ply_size(property.type);
+                    if (!property.list) {
+                        if (static_cast<size_t>(end - p) < value_size)
+                            return error("the file ends before the last face");
+                        p += value_size;
+                        continue;
+                    }
+                    size_t count_size = ply_size(property.count_type);
+                    if (static_cast<size_t>(end - p) < count_size)
+                        return error("the file ends before the last face");
+                    auto count = static_cast<size_t>(read_ply_value(p, property.count_type, swap));
+                    p += count_size;
+                    if (static_cast<size_t>(end - p) / value_size < count)
+                        return error("the file ends before the last face");
+                    if (&property != vertex_list) {
+                        p += count * value_size;
+                        continue;
+                    }
+                    face.clear();
+                    for (size_t k = 0; k < count; ++k, p += value_size) {
+                        // a negative int32 becomes too large to be a vertex
+                        uint32_t index = no_index;
+                        if (raw_indices) {
+                            std::memcpy(&index, p, sizeof(uint32_t));
+                        } else {
+                            double value = read_ply_value(p, property.type, swap);
+                            if (value >= 0 && value < vertex_count)
+                                index = static_cast<uint32_t>(value);
+                        }
+                        if (index >= vertex_count)
+                            return error("a face refers to a vertex that is not in the file");
+                        face.push_back(index);
+                    }
+                    for (size_t k = 1; k + 1 < face.size(); ++k) {
+                        mesh.indices.push_back(face[0]);
+                        mesh.indices.push_back(face[k]);
+                        mesh.indices.push_back(face[k + 1]);
+                    }
+                }
+            }
+        } else if (fixed_size) {
+            if (static_cast<size_t>(end - p) / std::max<size_t>(row_size, 1) < element.count)
+                return error("the file ends inside element " + element.name);
+            p += row_size * element.count;
+        } else {
+            for (size_t i = 0; i < element.count; ++i) {
+                for (const auto& property : element.properties) {
+                    size_t count = 1;
+                    if (property.list) {
+                        if (static_cast<size_t>(end - p) < ply_size(property.count_type))
+                            return error("the file ends inside element " + element.name);
+                        count = static_cast<size_t>(read_ply_value(p, property.count_type, swap));
+                        p += ply_size(property.count_type);
+                    }
+                    if (static_cast<size_t>(end - p) / ply_size(property.type) < count)
+                        return error("the file ends inside element " + element.name);
+                    p += count * ply_size(property.type);
+                }
+            }
+        }
+    }
+    if (!have_vertices)
+        return error("no vertices");
+    return true;
+}
+
+bool
+load_mesh(const std::string& filename, mesh_buffers& mesh)
+{
+    if (has_extension(filename, ".obj"))
+        return load_obj(filename, mesh);
+    if (has_extension(filename, ".ply"))
+        return load_ply(filename, mesh);
+    std::cerr << "Mesh " << filename << " is neither .obj nor .ply" << std::endl;
+    return false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <string>
+
+// Readers for triangle meshes. Each one reads the whole file into memory and parses it in place, in a single pass
+// over the data, and splits polygons into fans of triangles. They return false, after saying why on std::cerr, if the
+// file cannot be read or is not one they understand.
+
+// A Wavefront OBJ file: its v, vt, vn and f lines, with positive or negative indices. Corners that share a position
+// but not a uv or normal become separate vertices. Everything else, materials and groups included, is skipped.
+bool
+load_obj(const std::string& filename, mesh_buffers& mesh);
+
+// A binary PLY file in either byte order: x, y and z per vertex, with nx, ny and nz and u and v (or s and t) if they
+// are there, and a list of vertex_indices per face. Other elements and properties are skipped.
+bool
+load_ply(const std::string& filename, mesh_buffers& mesh);
+
+// load_obj or load_ply, by the extension of the file
+bool
+load_mesh(const std::string& filename, mesh_buffers& mesh);
+
+#endif
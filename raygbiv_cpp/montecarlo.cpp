@@ -4,6 +4,7 @@
 #include "montecarlo.h"
 
 #include "rtweekend.h"
+#include "sampler.h"
 #include "vec3.h"
 
 #include <iomanip>
@@ -129,6 +130,63 @@ uniformSampleTriangle(float u, float v, float area, float* pdf = nullptr)
     return vec3(1.0f - su0, v * su0, 0.0f);
 }
 
+// Root mean square error, over a 64x64 block of pixels, of each sampler's estimates of an integral. The samples
+// take their dimensions the way a camera path does: a pixel position, a point on the lens, the shutter time, and
+// then for the bounce the choice between light and material and a cosine-weighted direction. With whole_path false
+// only the bounce counts, and the estimate is of the fraction of cosine-weighted directions within 37 degrees of
+// the normal, 0.36. With whole_path true that is also multiplied by a pixel filter (averaging 1) and by
+// whether the lens point gets through an aperture stopped down to half the radius (a quarter of the time).
+void
+sampler_rmse(bool whole_path)
+{
+    const int pixels = 64;
+    const float exact = whole_path ? 0.25f * 0.36f : 0.36f;
+    const std::pair<const char*, sampler_type> types[] = { { "independent", sampler_type::independent },
+                                                           { "stratified", sampler_type::stratified },
+                                                           { "sobol", sampler_type::sobol },
+                                                           { "bluenoise", sampler_type::blue_noise } };
+
+    std::cout << std::setprecision(6) << "\nRMSE per pixel, " << (whole_path ? "whole path" : "bounce only") << '\n'
+              << std::setw(12) << "spp";
+    for (const auto& type : types) {
+        std::cout << std::setw(14) << type.first;
+    }
+    std::cout << '\n';
+
+    for (int spp = 4; spp <= 1024; spp *= 4) {
+        std::cout << std::setw(12) << spp;
+        for (const auto& type : types) {
+            auto smp = make_sampler(type.second, spp);
+            double squared_error = 0.0;
+            for (int j = 0; j < pixels; ++j) {
+                for (int i = 0; i < pixels; ++i) {
+                    double sum = 0.0;
+                    for (int s = 0; s < spp; ++s) {
+                        seed_thread_rng(static_cast<uint64_t>(j) * pixels + i, s);
+                        smp->start_pixel_sample(i, j, s);
+                        vec2 pixel = smp->get_2d();
+                        vec2 lens = smp->get_2d();
+                        smp->get_1d(); // time
+                        smp->get_1d(); // light or material
+                        vec2 bounce = smp->get_2d();
+
+                        float value = random_cosine_direction(bounce).z > 0.8f ? 1.0f : 0.0f;
+                        if (whole_path) {
+                            value *= 4.0f * pixel.x * pixel.y;
+                            value *= glm::length2(random_in_unit_disk(lens)) < 0.25f ? 1.0f : 0.0f;
+                        }
+                        sum += value;
+                    }
+                    double error = sum / spp - exact;
+                    squared_error += error * error;
+                }
+            }
+            std::cout << std::setw(14) << std::sqrt(squared_error / (pixels * pixels));
+        }
+        std::cout << '\n';
+    }
+}
+
 int
 main()
 {
@@ -140,4 +198,7 @@ main()
     }
     std::cout << std::fixed << std::setprecision(12);
     std::cout << "I = " << sum / N << '\n';
+
+    sampler_rmse(false);
+    sampler_rmse(true);
 }
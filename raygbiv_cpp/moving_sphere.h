@@ -6,24 +6,29 @@
 #include "rtweekend.h"
 
 #include "hittable.h"
+#include "sphere.h"
 
-class moving_sphere : public hittable
+class moving_sphere : public deferred_hittable
 {
   public:
     moving_sphere()
       : time0(0)
       , time1(0)
       , radius(0)
+      , mat_id(0)
     {}
-    moving_sphere(point3 cen0, point3 cen1, float _time0, float _time1, float r, shared_ptr<material> m)
+    moving_sphere(point3 cen0, point3 cen1, float _time0, float _time1, float r, uint32_t m)
       : center0(cen0)
       , center1(cen1)
       , time0(_time0)
       , time1(_time1)
       , radius(r)
-      , mat_ptr(m){};
+      , mat_id(m){};
 
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+    virtual void fill_hit(const ray& r, float t, float a, float b, hit_record& rec) const override;
     virtual bool bounding_box(float _time0, float _time1, aabb& output_box) const override;
 
     point3 center(float time) const;
@@ -32,7 +37,7 @@ class moving_sphere : public hittable
     point3 center0, center1;
     float time0, time1;
     float radius;
-    shared_ptr<material> mat_ptr;
+    uint32_t mat_id;
 };
 
 point3
@@ -42,7 +47,7 @@ moving_sphere::center(float time) const
 }
 
 bool
-moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+moving_sphere::intersect_t(const ray& r, float t_min, float t_max, float& t) const
 {
     vec3 oc = r.origin() - center(r.time());
     auto a = glm::length2(r.direction());
@@ -62,15 +67,53 @@ moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) cons
             return false;
     }
 
-    rec.t = root;
-    rec.p = r.at(rec.t);
-    auto outward_normal = (rec.p - center(r.time())) / radius;
-    rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    t = root;
+    return true;
+}
 
+void
+moving_sphere::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    // each ray sees the sphere where it was at the ray's own time
+    alignas(64) float center_x[ray_packet::max_width];
+    alignas(64) float center_y[ray_packet::max_width];
+    alignas(64) float center_z[ray_packet::max_width];
+    alignas(64) float t[ray_packet::max_width];
+    for (int lane = 0; lane < ray_packet::max_width; ++lane) {
+        point3 c = center(packet.rays[lane].time());
+        center_x[lane] = c.x;
+        center_y[lane] = c.y;
+        center_z[lane] = c.z;
+    }
+    auto center_of = [&](int first, simd_float& x, simd_float& y, simd_float& z) {
+        x = simd_load(center_x + first);
+        y = simd_load(center_y + first);
+        z = simd_load(center_z + first);
+    };
+    packet.record_deferred(packet_sphere_test(packet, lanes, center_of, radius, t), t, this);
+}
+
+bool
+moving_sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    float t;
+    if (!moving_sphere::intersect_t(r, t_min, t_max, t))
+        return false;
+
+    moving_sphere::fill_hit(r, t, 0.0f, 0.0f, rec);
     return true;
 }
 
+void
+moving_sphere::fill_hit(const ray& r, float t, float, float, hit_record& rec) const
+{
+    rec.t = t;
+    rec.p = r.at(t);
+    auto outward_normal = (rec.p - center(r.time())) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_id = mat_id;
+}
+
 bool
 moving_sphere::bounding_box(float _time0, float _time1, aabb& output_box) const
 {
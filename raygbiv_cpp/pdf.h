@@ -3,76 +3,102 @@
 #ifndef PDF_H
 #define PDF_H
 
-class pdf
-{
-  public:
-    virtual ~pdf() {}
+#include "hittable.h"
+#include "onb.h"
+#include "rtweekend.h"
 
-    // evaluate pdf at this vec3
-    virtual float value(const vec3& direction) const = 0;
+#include <variant>
 
-    // generate a random sample vec3 that conforms to this pdf distribution
-    virtual vec3 generate() const = 0;
-};
+// The pdfs are small values rather than a class hierarchy, so that building one for every bounce of a path costs
+// no heap allocation and no reference counting.
 
-class cosine_pdf : public pdf
+class cosine_pdf
 {
   public:
+    cosine_pdf() {}
     cosine_pdf(const vec3& w) { uvw.build_from_w(w); }
 
-    virtual float value(const vec3& direction) const override
+    // evaluate pdf at this vec3
+    float value(const vec3& direction) const
     {
         auto cosine = dot(unit_vector(direction), uvw.w());
         return (cosine <= 0) ? 0 : cosine / pi;
     }
 
-    virtual vec3 generate() const override { return uvw.local(random_cosine_direction()); }
+    // generate a sample vec3 that conforms to this pdf distribution, by warping the point u of the unit square
+    vec3 generate(const vec2& u) const { return uvw.local(random_cosine_direction(u)); }
 
   public:
     onb uvw;
 };
 
-class hittable_pdf : public pdf
+class hittable_pdf
 {
   public:
-    hittable_pdf(shared_ptr<hittable> p, const point3& origin)
-      : ptr(p)
-      , o(origin)
+    // the hittable is not owned, and must outlive the pdf
+    hittable_pdf(const hittable& p, const point3& origin)
+      : o(origin)
+      , ptr(&p)
     {}
 
-    virtual float value(const vec3& direction) const override { return ptr->pdf_value(o, direction); }
+    float value(const vec3& direction) const { return ptr->pdf_value(o, direction); }
 
-    virtual vec3 generate() const override { return ptr->random(o); }
+    vec3 generate(const vec2& u) const { return ptr->random(o, u); }
 
   public:
     point3 o;
-    shared_ptr<hittable> ptr;
+    const hittable* ptr;
 };
 
-class mixture_pdf : public pdf
+// any one of the pdfs above, held by value
+class pdf
 {
   public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1)
+    pdf() {}
+    pdf(const cosine_pdf& p)
+      : kind(p)
+    {}
+    pdf(const hittable_pdf& p)
+      : kind(p)
+    {}
+
+    float value(const vec3& direction) const
     {
-        p[0] = p0;
-        p[1] = p1;
+        return std::visit([&](const auto& p) { return p.value(direction); }, kind);
     }
 
-    virtual float value(const vec3& direction) const override
+    vec3 generate(const vec2& u) const
     {
-        return 0.5f * p[0]->value(direction) + 0.5f * p[1]->value(direction);
+        return std::visit([&](const auto& p) { return p.generate(u); }, kind);
     }
 
-    virtual vec3 generate() const override
+  private:
+    std::variant<cosine_pdf, hittable_pdf> kind;
+};
+
+// an even mixture of two pdfs, also held by value
+class mixture_pdf
+{
+  public:
+    mixture_pdf(const pdf& p0, const pdf& p1)
+    {
+        p[0] = p0;
+        p[1] = p1;
+    }
+
+    float value(const vec3& direction) const { return 0.5f * p[0].value(direction) + 0.5f * p[1].value(direction); }
+
+    // choose in [0,1) picks one of the two, and u is warped by the one picked
+    vec3 generate(float choose, const vec2& u) const
     {
-        if (random_float() < 0.5f)
-            return p[0]->generate();
+        if (choose < 0.5f)
+            return p[0].generate(u);
         else
-            return p[1]->generate();
+            return p[1].generate(u);
     }
 
   public:
-    shared_ptr<pdf> p[2];
+    pdf p[2];
 };
 
 #endif
@@ -12,7 +12,7 @@ class perlin
     {
         ranvec = new vec3[point_count];
         for (int i = 0; i < point_count; ++i) {
-            ranvec[i] = unit_vector(glm::linearRand(glm::vec3(-1,-1,-1), glm::vec3(1,1,1)));//::random(-1, 1));
+            ranvec[i] = unit_vector(random_vec3(-1.0f, 1.0f));
         }
 
         perm_x = perlin_generate_perm();
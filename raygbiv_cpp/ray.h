@@ -12,6 +12,8 @@ class ray
       : orig()
       , dir()
       , tm(0)
+      , inv_dir()
+      , sign(0)
     {}
 
     ray(const point3& origin,
@@ -20,18 +22,28 @@ class ray
       : orig(origin)
       , dir(direction)
       , tm(time)
+      , inv_dir(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z)
+      , sign((inv_dir.x < 0.0f ? 1 : 0) | (inv_dir.y < 0.0f ? 2 : 0) | (inv_dir.z < 0.0f ? 4 : 0))
     {}
 
     point3 origin() const { return orig; }
     vec3 direction() const { return dir; }
     float time() const { return tm; }
 
+    // 1 / direction, for the box tests every traversal step makes
+    const vec3& inverse_direction() const { return inv_dir; }
+    // bit a is set when the direction points down axis a
+    int sign_mask() const { return sign; }
+
     point3 at(float t) const { return orig + t * dir; }
 
   public:
     point3 orig;
     vec3 dir;
     float tm;
+    // derived from dir by the constructor
+    vec3 inv_dir;
+    int sign;
 };
 
 #endif
@@ -0,0 +1,514 @@
+#pragma once
+
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "hittable.h"
+#include "ray.h"
+#include "rtweekend.h"
+
+#if defined(__AVX__)
+#define PACKET_AVX
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PACKET_SSE
+#include <immintrin.h>
+#endif
+
+// A group of floats worked on at once: 8 with AVX, 4 with SSE and 1 without either. Comparisons give a mask that has
+// every bit set in the lanes where they hold.
+struct simd_float
+{
+#if defined(PACKET_AVX)
+    static constexpr int width = 8;
+    __m256 v;
+#elif defined(PACKET_SSE)
+    static constexpr int width = 4;
+    __m128 v;
+#else
+    static constexpr int width = 1;
+    float v;
+#endif
+};
+
+#if defined(PACKET_AVX)
+
+inline simd_float
+simd_load(const float* p)
+{
+    return { _mm256_load_ps(p) };
+}
+inline simd_float
+simd_set(float f)
+{
+    return { _mm256_set1_ps(f) };
+}
+inline simd_float
+operator+(simd_float a, simd_float b)
+{
+    return { _mm256_add_ps(a.v, b.v) };
+}
+inline simd_float
+operator-(simd_float a, simd_float b)
+{
+    return { _mm256_sub_ps(a.v, b.v) };
+}
+inline simd_float
+operator*(simd_float a, simd_float b)
+{
+    return { _mm256_mul_ps(a.v, b.v) };
+}
+inline simd_float
+operator/(simd_float a, simd_float b)
+{
+    return { _mm256_div_ps(a.v, b.v) };
+}
+inline simd_float
+operator&(simd_float a, simd_float b)
+{
+    return { _mm256_and_ps(a.v, b.v) };
+}
+inline simd_float
+operator|(simd_float a, simd_float b)
+{
+    return { _mm256_or_ps(a.v, b.v) };
+}
+inline simd_float
+simd_min(simd_float a, simd_float b)
+{
+    return { _mm256_min_ps(a.v, b.v) };
+}
+inline simd_float
+simd_max(simd_float a, simd_float b)
+{
+    return { _mm256_max_ps(a.v, b.v) };
+}
+inline simd_float
+simd_sqrt(simd_float a)
+{
+    return { _mm256_sqrt_ps(a.v) };
+}
+inline simd_float
+operator<=(simd_float a, simd_float b)
+{
+    return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) };
+}
+inline simd_float
+operator>=(simd_float a, simd_float b)
+{
+    return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) };
+}
+// a in the lanes of mask, b in the others
+inline simd_float
+simd_select(simd_float mask, simd_float a, simd_float b)
+{
+    return { _mm256_blendv_ps(b.v, a.v, mask.v) };
+}
+// a bit for each lane of mask that is set
+inline int
+simd_bits(simd_float mask)
+{
+    return _mm256_movemask_ps(mask.v);
+}
+// a mask of the lanes whose bits are set in bits
+inline simd_float
+simd_lanes(uint32_t bits)
+{
+    return { _mm256_castsi256_ps(_mm256_setr_epi32(-int(bits & 1),
+                                                   -int((bits >> 1) & 1),
+                                                   -int((bits >> 2) & 1),
+                                                   -int((bits >> 3) & 1),
+                                                   -int((bits >> 4) & 1),
+                                                   -int((bits >> 5) & 1),
+                                                   -int((bits >> 6) & 1),
+                                                   -int((bits >> 7) & 1))) };
+}
+inline void
+simd_store(float* p, simd_float a)
+{
+    _mm256_store_ps(p, a.v);
+}
+
+#elif defined(PACKET_SSE)
+
+inline simd_float
+simd_load(const float* p)
+{
+    return { _mm_load_ps(p) };
+}
+inline simd_float
+simd_set(float f)
+{
+    return { _mm_set1_ps(f) };
+}
+inline simd_float
+operator+(simd_float a, simd_float b)
+{
+    return { _mm_add_ps(a.v, b.v) };
+}
+inline simd_float
+operator-(simd_float a, simd_float b)
+{
+    return { _mm_sub_ps(a.v, b.v) };
+}
+inline simd_float
+operator*(simd_float a, simd_float b)
+{
+    return { _mm_mul_ps(a.v, b.v) };
+}
+inline simd_float
+operator/(simd_float a, simd_float b)
+{
+    return { _mm_div_ps(a.v, b.v) };
+}
+inline simd_float
+operator&(simd_float a, simd_float b)
+{
+    return { _mm_and_ps(a.v, b.v) };
+}
+inline simd_float
+operator|(simd_float a, simd_float b)
+{
+    return { _mm_or_ps(a.v, b.v) };
+}
+inline simd_float
+simd_min(simd_float a, simd_float b)
+{
+    return { _mm_min_ps(a.v, b.v) };
+}
+inline simd_float
+simd_max(simd_float a, simd_float b)
+{
+    return { _mm_max_ps(a.v, b.v) };
+}
+inline simd_float
+simd_sqrt(simd_float a)
+{
+    return { _mm_sqrt_ps(a.v) };
+}
+inline simd_float
+operator<=(simd_float a, simd_float b)
+{
+    return { _mm_cmple_ps(a.v, b.v) };
+}
+inline simd_float
+operator>=(simd_float a, simd_float b)
+{
+    return { _mm_cmpge_ps(a.v, b.v) };
+}
+// a in the lanes of mask, b in the others; SSE2 has no blend
+inline simd_float
+simd_select(simd_float mask, simd_float a, simd_float b)
+{
+    return { _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) };
+}
+// a bit for each lane of mask that is set
+inline int
+simd_bits(simd_float mask)
+{
+    return _mm_movemask_ps(mask.v);
+}
+// a mask of the lanes whose bits are set in bits
+inline simd_float
+simd_lanes(uint32_t bits)
+{
+    return { _mm_castsi128_ps(
+      _mm_setr_epi32(-int(bits & 1), -int((bits >> 1) & 1), -int((bits >> 2) & 1), -int((bits >> 3) & 1))) };
+}
+inline void
+simd_store(float* p, simd_float a)
+{
+    _mm_store_ps(p, a.v);
+}
+
+#else
+
+// one lane; a mask is a float with every bit set or none, as the SIMD comparisons make them
+
+inline float
+simd_mask(bool b)
+{
+    uint32_t bits = b ? ~uint32_t(0) : 0;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+inline bool
+simd_is_set(float mask)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &mask, sizeof(bits));
+    return bits != 0;
+}
+inline simd_float
+simd_load(const float* p)
+{
+    return { *p };
+}
+inline simd_float
+simd_set(float f)
+{
+    return { f };
+}
+inline simd_float
+operator+(simd_float a, simd_float b)
+{
+    return { a.v + b.v };
+}
+inline simd_float
+operator-(simd_float a, simd_float b)
+{
+    return { a.v - b.v };
+}
+inline simd_float
+operator*(simd_float a, simd_float b)
+{
+    return { a.v * b.v };
+}
+inline simd_float
+operator/(simd_float a, simd_float b)
+{
+    return { a.v / b.v };
+}
+inline simd_float
+operator&(simd_float a, simd_float b)
+{
+    return { simd_mask(simd_is_set(a.v) && simd_is_set(b.v)) };
+}
+inline simd_float
+operator|(simd_float a, simd_float b)
+{
+    return { simd_mask(simd_is_set(a.v) || simd_is_set(b.v)) };
+}
+inline simd_float
+simd_min(simd_float a, simd_float b)
+{
+    return { b.v < a.v ? b.v : a.v };
+}
+inline simd_float
+simd_max(simd_float a, simd_float b)
+{
+    return { b.v > a.v ? b.v : a.v };
+}
+inline simd_float
+simd_sqrt(simd_float a)
+{
+    return { std::sqrt(a.v) };
+}
+inline simd_float
+operator<=(simd_float a, simd_float b)
+{
+    return { simd_mask(a.v <= b.v) };
+}
+inline simd_float
+operator>=(simd_float a, simd_float b)
+{
+    return { simd_mask(a.v >= b.v) };
+}
+inline simd_float
+simd_select(simd_float mask, simd_float a, simd_float b)
+{
+    return simd_is_set(mask.v) ? a : b;
+}
+inline int
+simd_bits(simd_float mask)
+{
+    return simd_is_set(mask.v) ? 1 : 0;
+}
+inline simd_float
+simd_lanes(uint32_t bits)
+{
+    return { simd_mask((bits & 1) != 0) };
+}
+inline void
+simd_store(float* p, simd_float a)
+{
+    *p = a.v;
+}
+
+#endif
+
+// Up to max_width rays traced through the scene together. Camera rays through neighbouring pixels mostly pass through
+// the same boxes and hit the same objects, so a tree can be walked once for all of them, and the rays tested against
+// a box or a primitive a SIMD group at a time. Lanes are picked by bit masks, bit i for lane i.
+//
+// Objects with a SIMD test only find t and where on the object the hit is, and leave the shading data of the lane's
+// record to be filled in by their own fill_hit() at the end, in fill_records(); any other object's hit() fills the
+// record in right away.
+struct alignas(64) ray_packet
+{
+    static constexpr int max_width = 16;
+    static_assert(max_width % simd_float::width == 0, "the lanes have to fill whole SIMD groups");
+
+    // the rays lane by lane, for the SIMD tests; lanes without a ray hold one that misses everything
+    alignas(64) float origin_x[max_width];
+    alignas(64) float origin_y[max_width];
+    alignas(64) float origin_z[max_width];
+    alignas(64) float direction_x[max_width];
+    alignas(64) float direction_y[max_width];
+    alignas(64) float direction_z[max_width];
+    alignas(64) float inv_dir_x[max_width];
+    alignas(64) float inv_dir_y[max_width];
+    alignas(64) float inv_dir_z[max_width];
+    // the closest hit so far of each lane, or how far it may go
+    alignas(64) float t_max[max_width];
+    // the coordinates on the object of each lane's deferred hit, as its SIMD test worked them out, for fill_hit()
+    alignas(64) float hit_a[max_width];
+    alignas(64) float hit_b[max_width];
+
+    ray rays[max_width];
+    hit_record rec[max_width];
+    // the object whose fill_hit() still has to fill in rec, or nullptr if it has been filled in
+    const deferred_hittable* deferred[max_width];
+    // lanes that hit something
+    uint32_t hit_lanes = 0;
+    float t_min = RAY_EPSILON;
+
+    ray_packet() { clear(); }
+
+    // no rays at all
+    void clear()
+    {
+        for (int lane = 0; lane < max_width; ++lane) {
+            origin_x[lane] = origin_y[lane] = origin_z[lane] = 0.0f;
+            direction_x[lane] = direction_y[lane] = direction_z[lane] = 1.0f;
+            inv_dir_x[lane] = inv_dir_y[lane] = inv_dir_z[lane] = 1.0f;
+            t_max[lane] = -infinity;
+            deferred[lane] = nullptr;
+        }
+        hit_lanes = 0;
+    }
+
+    void set_ray(int lane, const ray& r, float lane_t_max = infinity)
+    {
+        rays[lane] = r;
+        origin_x[lane] = r.orig.x;
+        origin_y[lane] = r.orig.y;
+        origin_z[lane] = r.orig.z;
+        direction_x[lane] = r.dir.x;
+        direction_y[lane] = r.dir.y;
+        direction_z[lane] = r.dir.z;
+        inv_dir_x[lane] = r.inv_dir.x;
+        inv_dir_y[lane] = r.inv_dir.y;
+        inv_dir_z[lane] = r.inv_dir.z;
+        t_max[lane] = lane_t_max;
+        deferred[lane] = nullptr;
+    }
+
+    // a hit at t[lane] in each of the lanes of hits, at a[lane], b[lane] on object if it has coordinates, for object
+    // to fill in the records of
+    void record_deferred(uint32_t hits,
+                         const float* t,
+                         const deferred_hittable* object,
+                         const float* a = nullptr,
+                         const float* b = nullptr)
+    {
+        hit_lanes |= hits;
+        for (int lane = 0; hits != 0; ++lane, hits >>= 1) {
+            if (hits & 1) {
+                t_max[lane] = t[lane];
+                hit_a[lane] = a ? a[lane] : 0.0f;
+                hit_b[lane] = b ? b[lane] : 0.0f;
+                deferred[lane] = object;
+            }
+        }
+    }
+
+    // a hit of a lane whose record is already filled in
+    void record(int lane, const hit_record& hit)
+    {
+        rec[lane] = hit;
+        t_max[lane] = hit.t;
+        deferred[lane] = nullptr;
+        hit_lanes |= 1u << lane;
+    }
+
+    // the farthest any of lanes may still go
+    float farthest(uint32_t lanes) const
+    {
+        float t = -infinity;
+        for (int lane = 0; lanes != 0; ++lane, lanes >>= 1) {
+            if ((lanes & 1) && t_max[lane] > t)
+                t = t_max[lane];
+        }
+        return t;
+    }
+
+    // fills in the record of lane if its hit was found by a SIMD test
+    void fill_record(int lane)
+    {
+        if (const deferred_hittable* object = deferred[lane]) {
+            deferred[lane] = nullptr;
+            object->fill_hit(rays[lane], t_max[lane], hit_a[lane], hit_b[lane], rec[lane]);
+        }
+    }
+
+    // fills in the records of the lanes whose hits were found by SIMD tests, from what the tests found
+    void fill_records()
+    {
+        for (int lane = 0; lane < max_width; ++lane)
+            fill_record(lane);
+    }
+};
+
+// The lanes of lanes whose rays pass through the box somewhere between t_min and their own t_max. If t_enter is given,
+// it is set to where the first of them enters the box, for ordering and culling boxes by.
+inline uint32_t
+packet_box_test(const ray_packet& packet,
+                uint32_t lanes,
+                float min_x,
+                float min_y,
+                float min_z,
+                float max_x,
+                float max_y,
+                float max_z,
+                float* t_enter = nullptr)
+{
+    const simd_float lo_x = simd_set(min_x), lo_y = simd_set(min_y), lo_z = simd_set(min_z);
+    const simd_float hi_x = simd_set(max_x), hi_y = simd_set(max_y), hi_z = simd_set(max_z);
+    const simd_float t_min = simd_set(packet.t_min);
+    simd_float nearest = simd_set(infinity);
+    uint32_t hits = 0;
+    for (int first = 0; first < ray_packet::max_width && (lanes >> first) != 0; first += simd_float::width) {
+        uint32_t group = (lanes >> first) & ((1u << simd_float::width) - 1);
+        if (group == 0)
+            continue;
+        simd_float o = simd_load(packet.origin_x + first), inv = simd_load(packet.inv_dir_x + first);
+        simd_float t0 = (lo_x - o) * inv, t1 = (hi_x - o) * inv;
+        simd_float near = simd_max(t_min, simd_min(t0, t1));
+        simd_float far = simd_min(simd_load(packet.t_max + first), simd_max(t0, t1));
+        o = simd_load(packet.origin_y + first);
+        inv = simd_load(packet.inv_dir_y + first);
+        t0 = (lo_y - o) * inv;
+        t1 = (hi_y - o) * inv;
+        near = simd_max(near, simd_min(t0, t1));
+        far = simd_min(far, simd_max(t0, t1));
+        o = simd_load(packet.origin_z + first);
+        inv = simd_load(packet.inv_dir_z + first);
+        t0 = (lo_z - o) * inv;
+        t1 = (hi_z - o) * inv;
+        near = simd_max(near, simd_min(t0, t1));
+        far = simd_min(far, simd_max(t0, t1));
+
+        // lanes outside of lanes hold rays of their own, which must not set t_enter
+        simd_float inside = (near <= far) & simd_lanes(group);
+        uint32_t group_hits = static_cast<uint32_t>(simd_bits(inside));
+        if (group_hits != 0) {
+            hits |= group_hits << first;
+            nearest = simd_min(nearest, simd_select(inside, near, simd_set(infinity)));
+        }
+    }
+    if (hits != 0 && t_enter) {
+        alignas(64) float t[simd_float::width];
+        simd_store(t, nearest);
+        *t_enter = t[0];
+        for (int i = 1; i < simd_float::width; ++i)
+            *t_enter = std::fmin(*t_enter, t[i]);
+    }
+    return hits;
+}
+
+#endif
@@ -6,12 +6,17 @@
 #include "argparse.hpp"
 #include "rtweekend.h"
 
+#include "bvh_node.h"
 #include "camera.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "float_image.h"
 #include "hittable_list.h"
 #include "image_buffer.h"
 #include "material.h"
 #include "pdf.h"
+#include "ray_packet.h"
+#include "sampler.h"
 #include "scene.h"
 #include "threadpool.h"
 
@@ -21,59 +26,282 @@
 #include "stb_image.h"
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <new>
 #include <sstream>
 #include <vector>
 
+// rays traced by this thread during the current tile, added to total_rays when the tile is done
+static thread_local uint64_t thread_ray_count = 0;
+static std::atomic<uint64_t> total_rays(0);
+// camera samples taken, which adaptive sampling makes vary from pixel to pixel
+static std::atomic<uint64_t> total_samples(0);
+
+// render progress
+static std::atomic<int> tiles_done(0);
+static int tiles_total = 0;
+static int current_pass = 0;
+
+// path_color always follows this many bounces before Russian roulette may end a path
+static const int roulette_min_bounces = 3;
+
+// paths the wavefront integrator aims to have in flight per thread; a tile takes as many samples of each of its
+// pixels at once as it needs to get there
+static const int wavefront_size = 1 << 14;
+
+// how far, relative to its distance, the surface a light sample reaches may be from the light's own shape, which
+// the scene gives apart from the emitting object, and still count as the light
+static const float light_surface_tolerance = 1e-4f;
+
+#ifdef RAYGBIV_COUNT_ALLOCATIONS
+// every call to the global operator new, so that the render can report how much it allocates per sample; the
+// path tracing itself should not allocate at all. Only built with the RAYGBIV_COUNT_ALLOCATIONS option, since it
+// replaces the allocator of everything linked into the program.
+static std::atomic<uint64_t> heap_allocations(0);
+
+static void*
+counted_alloc(std::size_t size, std::size_t alignment) noexcept
+{
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0)
+        size = 1;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        return std::malloc(size);
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment
+    return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+static void
+counted_free(void* p, std::size_t alignment) noexcept
+{
+#ifdef _WIN32
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        _aligned_free(p);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    std::free(p);
+}
+
+static void*
+counted_new(std::size_t size, std::size_t alignment)
+{
+    if (void* p = counted_alloc(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void*
+operator new(std::size_t size)
+{
+    return counted_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void*
+operator new[](std::size_t size)
+{
+    return counted_new(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void*
+operator new(std::size_t size, std::align_val_t alignment)
+{
+    return counted_new(size, static_cast<std::size_t>(alignment));
+}
+
+void*
+operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return counted_new(size, static_cast<std::size_t>(alignment));
+}
+
+void*
+operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void*
+operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void*
+operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+void*
+operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return counted_alloc(size, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete(void* p) noexcept
+{
+    counted_free(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void
+operator delete[](void* p) noexcept
+{
+    counted_free(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void
+operator delete(void* p, std::size_t) noexcept
+{
+    counted_free(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void
+operator delete[](void* p, std::size_t) noexcept
+{
+    counted_free(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void
+operator delete(void* p, std::align_val_t alignment) noexcept
+{
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete[](void* p, std::align_val_t alignment) noexcept
+{
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    counted_free(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void
+operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    counted_free(p, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void
+operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+
+void
+operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    counted_free(p, static_cast<std::size_t>(alignment));
+}
+#endif
+
+// the first segment of a path, when it has already been traced along with others in a ray_packet
+struct traced_segment
+{
+    bool hit;
+    hit_record rec;
+};
+
 color
-ray_color(const ray& r, const color& background, const hittable& world, const shared_ptr<hittable>& lights, int depth)
+ray_color(const ray& r,
+          const color& background,
+          const hittable& world,
+          const shared_ptr<hittable>& lights,
+          const material_table& materials,
+          sampler& smp,
+          int depth,
+          const traced_segment* first = nullptr)
 {
     // If we've exceeded the ray bounce limit, no more light is gathered.
     if (depth <= 0)
         return color(0.0f, 0.0f, 0.0f);
 
     hit_record rec;
-    bool isHit = world.hit(r, RAY_EPSILON, infinity, rec);
+    bool isHit;
+    if (first) {
+        isHit = first->hit;
+        rec = first->rec;
+    } else {
+        thread_ray_count++;
+        isHit = world.hit(r, RAY_EPSILON, infinity, rec);
+    }
     // If the ray hits nothing, return the background color.
     if (!isHit) {
         return background;
     }
 
-    color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+    const material& mat = materials[rec.mat_id];
+    color emitted = mat.emitted(r, rec, rec.u, rec.v, rec.p);
     // returns the scattering pdf for this material inside of srec
     scatter_record srec;
-    bool doesScatter = rec.mat_ptr->scatter(r, rec, srec);
+    bool doesScatter = mat.scatter(r, rec, srec);
     if (!doesScatter) {
         return emitted;
     }
 
     // implicitly sampled specular ray
     if (srec.is_specular) {
-        return srec.attenuation * ray_color(srec.specular_ray, background, world, lights, depth - 1);
+        return srec.attenuation * ray_color(srec.specular_ray, background, world, lights, materials, smp, depth - 1);
     }
 
-    std::shared_ptr<pdf> p;
+    float choose = smp.get_1d();
+    vec2 u = smp.get_2d();
+    ray scattered;
+    float pdf_val;
     if (lights) {
-        auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-
         // 50-50 chance of sampling toward light or toward scatter direction
-        p.reset(new mixture_pdf(light_ptr, srec.pdf_ptr));
+        mixture_pdf p(hittable_pdf(*lights, rec.p), srec.scatter_pdf);
 
+        // generate sample from MIS pdf
+        scattered = ray(rec.p, p.generate(choose, u), r.time());
+        // evaluate pdf(generated sample)
+        pdf_val = p.value(scattered.direction());
     } else {
-        p = srec.pdf_ptr;
+        scattered = ray(rec.p, srec.scatter_pdf.generate(u), r.time());
+        pdf_val = srec.scatter_pdf.value(scattered.direction());
     }
-    // generate sample from MIS pdf
-    ray scattered = ray(rec.p, p->generate(), r.time());
-    // evaluate pdf(generated sample)
-    auto pdf_val = p->value(scattered.direction());
 
-    return emitted + srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) *
-                       ray_color(scattered, background, world, lights, depth - 1) / pdf_val;
+    return emitted + srec.attenuation * mat.scattering_pdf(r, rec, scattered) *
+                       ray_color(scattered, background, world, lights, materials, smp, depth - 1) / pdf_val;
 }
 
 color
-path_color(const ray& r, const color& background, const hittable& world, const shared_ptr<hittable>& lights, int depth)
+path_color(const ray& r,
+           const color& background,
+           const hittable& world,
+           const shared_ptr<hittable>& lights,
+           const material_table& materials,
+           sampler& smp,
+           int depth,
+           const traced_segment* first = nullptr)
 {
     // this is the running total color sample for this path
     color path_contrib = color(0.0f, 0.0f, 0.0f);
@@ -87,8 +315,15 @@ path_color(const ray& r, const color& background, const hittable& world, const s
 
     for (int i = 0; i < depth; ++i) {
         hit_record rec;
-        // do intersection test
-        bool hit = world.hit(path_ray, RAY_EPSILON, infinity, rec);
+        bool hit;
+        if (i == 0 && first) {
+            hit = first->hit;
+            rec = first->rec;
+        } else {
+            // do intersection test
+            thread_ray_count++;
+            hit = world.hit(path_ray, RAY_EPSILON, infinity, rec);
+        }
 
         // If the ray hits nothing, add background color contribution and terminate path
         if (!hit) {
@@ -96,11 +331,12 @@ path_color(const ray& r, const color& background, const hittable& world, const s
             break;
         }
 
+        const material& mat = materials[rec.mat_id];
         scatter_record srec;
-        color emitted = rec.mat_ptr->emitted(path_ray, rec, rec.u, rec.v, rec.p);
+        color emitted = mat.emitted(path_ray, rec, rec.u, rec.v, rec.p);
         // returns the scattering pdf for this material inside of srec
         // if scatter returns false, terminate path!
-        if (!rec.mat_ptr->scatter(path_ray, rec, srec)) {
+        if (!mat.scatter(path_ray, rec, srec)) {
             path_contrib += attenuation * emitted;
             break;
         }
@@ -112,31 +348,547 @@ path_color(const ray& r, const color& background, const hittable& world, const s
             // set the next ray to trace
             path_ray = srec.specular_ray;
         } else {
-            auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-
-            // 50-50 chance of sampling toward light or toward scatter direction
-            mixture_pdf p(light_ptr, srec.pdf_ptr);
+            float choose = smp.get_1d();
+            vec2 u = smp.get_2d();
+            ray scattered;
+            float pdf_val;
+            if (lights) {
+                // 50-50 chance of sampling toward light or toward scatter direction
+                mixture_pdf p(hittable_pdf(*lights, rec.p), srec.scatter_pdf);
 
-            // generate sample from MIS pdf: this will be the next path segment to trace
-            ray scattered = ray(rec.p, p.generate(), r.time());
-            // evaluate pdf(generated sample)
-            auto pdf_val = p.value(scattered.direction());
+                // generate sample from MIS pdf: this will be the next path segment to trace
+                scattered = ray(rec.p, p.generate(choose, u), path_ray.time());
+                // evaluate pdf(generated sample)
+                pdf_val = p.value(scattered.direction());
+            } else {
+                scattered = ray(rec.p, srec.scatter_pdf.generate(u), path_ray.time());
+                pdf_val = srec.scatter_pdf.value(scattered.direction());
+            }
 
             path_contrib += attenuation * emitted;
-            attenuation *= srec.attenuation * rec.mat_ptr->scattering_pdf(path_ray, rec, scattered) / pdf_val;
+            attenuation *= srec.attenuation * mat.scattering_pdf(path_ray, rec, scattered) / pdf_val;
             path_ray = scattered;
         }
+
+        // Russian roulette: past the first few bounces, end the path with a probability that grows as its
+        // throughput drops, and weight the paths that go on by the inverse so the expected value is unchanged
+        if (i + 1 >= roulette_min_bounces) {
+            float survive = std::min(std::max(attenuation.x, std::max(attenuation.y, attenuation.z)), 0.95f);
+            if (!(smp.get_1d() < survive))
+                break;
+            attenuation /= survive;
+        }
     }
     return path_contrib;
 }
 
+// the camera ray of sample s of pixel (i, j); seeds the thread's rng and starts smp on the sample, so that the rest of
+// the path draws the same numbers however the samples are ordered
+ray
+camera_sample(const camera& cam, const render_settings& rs, sampler& smp, int i, int j, int s)
+{
+    seed_thread_rng(static_cast<uint64_t>(j) * rs.image_width + i, s);
+    smp.start_pixel_sample(i, j, s);
+    vec2 pixel_sample = smp.get_2d();
+    vec2 lens_sample = smp.get_2d();
+    float time_sample = smp.get_1d();
+    auto u = (i + pixel_sample.x) / (rs.image_width - 1);
+    auto v = (j + pixel_sample.y) / (rs.image_height - 1);
+    return cam.get_ray(u, v, lens_sample, time_sample);
+}
+
+// adds the luminance of sample, the pixel's s-th, to its running statistics; true once adaptive sampling can stop it
+bool
+adaptive_converged(accumulated_pixel& pixel, const color& sample, int s, const render_settings& rs)
+{
+    if (rs.adaptive_error <= 0.0f)
+        return false;
+    float y = luminance(sample);
+    float& mean = pixel.luminance_mean;
+    float& m2 = pixel.luminance_m2;
+    float delta = y - mean;
+    mean += delta / s;
+    m2 += delta * (y - mean);
+    // stop once the standard error of the mean is within the target fraction of it
+    if (s >= rs.min_samples && s > 1 && std::sqrt(m2 / ((s - 1) * s)) <= rs.adaptive_error * mean) {
+        pixel.converged = true;
+        return true;
+    }
+    return false;
+}
+
+// Like the loop in render_tile, but with the camera rays of a block of neighbouring pixels traced together in one
+// ray_packet, one sample each at a time; the rest of every path is traced on its own. Returns the samples taken.
+uint64_t
+render_tile_packets(const hittable_list& world,
+                    const shared_ptr<hittable_list>& lights,
+                    const material_table& materials,
+                    const camera& cam,
+                    accumulation_buffer& film,
+                    const render_settings& rs,
+                    color background,
+                    int last_sample,
+                    int xstart,
+                    int ystart,
+                    int xend,
+                    int yend,
+                    sampler& smp)
+{
+    // 2x2, 4x2 or 4x4 pixels
+    int block_width = rs.packet_width >= 8 ? 4 : 2;
+    int block_height = rs.packet_width / block_width;
+
+    struct lane_pixel
+    {
+        accumulated_pixel* pixel;
+        int i, j;
+        int first_sample, s;
+        color sum;
+        // where the rng and the sampler were left by the camera sample, for the path to go on from
+        pcg32 rng;
+        int dimension;
+    };
+    lane_pixel pixels[ray_packet::max_width];
+    ray_packet packet;
+    uint64_t tile_samples = 0;
+
+    for (int by = yend - 1; by >= ystart; by -= block_height) {
+        for (int bx = xstart; bx < xend; bx += block_width) {
+            uint32_t active = 0;
+            int n_lanes = 0;
+            for (int dy = 0; dy < block_height && by - dy >= ystart; ++dy) {
+                for (int dx = 0; dx < block_width && bx + dx < xend; ++dx) {
+                    auto& pixel = film.at(bx + dx, by - dy);
+                    if (pixel.converged || pixel.samples >= last_sample)
+                        continue;
+                    color sum(0.0f, 0.0f, 0.0f);
+                    pixels[n_lanes] = { &pixel, bx + dx, by - dy, pixel.samples, pixel.samples, sum, pcg32(), 0 };
+                    active |= 1u << n_lanes++;
+                }
+            }
+
+            while (active != 0) {
+                packet.clear();
+                for (int lane = 0; lane < n_lanes; ++lane) {
+                    if ((active >> lane) & 1) {
+                        lane_pixel& p = pixels[lane];
+                        packet.set_ray(lane, camera_sample(cam, rs, smp, p.i, p.j, p.s));
+                        p.rng = thread_rng();
+                        p.dimension = smp.next_dimension();
+                        thread_ray_count++;
+                    }
+                }
+                world.intersect_packet(packet, active);
+                packet.fill_records();
+
+                for (int lane = 0; lane < n_lanes; ++lane) {
+                    if (!((active >> lane) & 1))
+                        continue;
+                    lane_pixel& p = pixels[lane];
+                    thread_rng() = p.rng;
+                    smp.resume_pixel_sample(p.i, p.j, p.s, p.dimension);
+                    traced_segment first = { ((packet.hit_lanes >> lane) & 1) != 0, packet.rec[lane] };
+                    const ray& r = packet.rays[lane];
+                    color sample;
+                    if (rs.integrator == integrator_type::recursive)
+                        sample = ray_color(r, background, world, lights, materials, smp, rs.max_path_size, &first);
+                    else
+                        sample = path_color(r, background, world, lights, materials, smp, rs.max_path_size, &first);
+                    p.sum += sample;
+                    ++p.s;
+
+                    if (adaptive_converged(*p.pixel, sample, p.s, rs) || p.s >= last_sample) {
+                        p.pixel->sum += p.sum;
+                        p.pixel->samples += p.s - p.first_sample;
+                        tile_samples += p.s - p.first_sample;
+                        active &= ~(1u << lane);
+                    }
+                }
+            }
+        }
+    }
+    return tile_samples;
+}
+
+// The paths of a wavefront render, kept field by field so that each stage only streams through the fields it uses.
+// A path is one sample of one pixel of the tile. The vectors keep their capacity from tile to tile, so once the
+// first tiles have grown them the render does not allocate.
+struct wavefront_paths
+{
+    // a pixel of the tile and what it has gathered in the tile so far
+    struct tile_pixel
+    {
+        accumulated_pixel* pixel;
+        int i, j;
+        int first_sample, s;
+        color sum;
+        bool done;
+    };
+    std::vector<tile_pixel> pixels;
+
+    // which of pixels the path is a sample of, and which sample
+    std::vector<uint32_t> pixel;
+    std::vector<int> sample;
+    // where the path's random numbers and sampler dimensions go on from, as if it were traced on its own
+    std::vector<pcg32> rng;
+    std::vector<int> dimension;
+    // the segment to trace next
+    std::vector<float> origin_x, origin_y, origin_z;
+    std::vector<float> direction_x, direction_y, direction_z;
+    std::vector<float> time;
+    std::vector<int> bounce;
+    std::vector<color> attenuation;
+    std::vector<color> radiance;
+    // what the segment hit
+    std::vector<uint8_t> hit;
+    std::vector<hit_record> rec;
+    // the pdf the segment's direction was sampled with, to weigh an emitter it hits against the light samples; 0
+    // when it was not sampled toward the lights, from the camera or a specular bounce
+    std::vector<float> scatter_pdf;
+    // the light sample of the path's last bounce, from the segment's origin: the direction toward the light, the
+    // distance to the light's shape along it, the throughput times the material's scattering there, and the pdf
+    // the segment's own direction would have taken it with
+    std::vector<float> shadow_x, shadow_y, shadow_z;
+    std::vector<float> shadow_t;
+    std::vector<color> shadow_weight;
+    std::vector<float> shadow_pdf;
+
+    // the paths still being traced, and the ones with a light sample to connect, with room to sort them into
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> shadowed;
+    std::vector<uint32_t> sorted;
+    std::vector<uint32_t> key_start;
+
+    size_t size() const { return pixel.size(); }
+
+    void clear()
+    {
+        pixel.clear();
+        sample.clear();
+        rng.clear();
+        dimension.clear();
+        origin_x.clear();
+        origin_y.clear();
+        origin_z.clear();
+        direction_x.clear();
+        direction_y.clear();
+        direction_z.clear();
+        time.clear();
+        bounce.clear();
+        attenuation.clear();
+        radiance.clear();
+        hit.clear();
+        rec.clear();
+        scatter_pdf.clear();
+        shadow_x.clear();
+        shadow_y.clear();
+        shadow_z.clear();
+        shadow_t.clear();
+        shadow_weight.clear();
+        shadow_pdf.clear();
+        active.clear();
+        shadowed.clear();
+    }
+
+    void add(uint32_t pixel_index, int s, const ray& r, const pcg32& path_rng, int path_dimension)
+    {
+        pixel.push_back(pixel_index);
+        sample.push_back(s);
+        rng.push_back(path_rng);
+        dimension.push_back(path_dimension);
+        origin_x.push_back(r.orig.x);
+        origin_y.push_back(r.orig.y);
+        origin_z.push_back(r.orig.z);
+        direction_x.push_back(r.dir.x);
+        direction_y.push_back(r.dir.y);
+        direction_z.push_back(r.dir.z);
+        time.push_back(r.time());
+        bounce.push_back(0);
+        attenuation.push_back(color(1.0f, 1.0f, 1.0f));
+        radiance.push_back(color(0.0f, 0.0f, 0.0f));
+        hit.push_back(0);
+        rec.emplace_back();
+        scatter_pdf.push_back(0.0f);
+        shadow_x.push_back(0.0f);
+        shadow_y.push_back(0.0f);
+        shadow_z.push_back(0.0f);
+        shadow_t.push_back(0.0f);
+        shadow_weight.emplace_back(0.0f, 0.0f, 0.0f);
+        shadow_pdf.push_back(0.0f);
+    }
+
+    ray path_ray(uint32_t p) const
+    {
+        return ray(point3(origin_x[p], origin_y[p], origin_z[p]),
+                   vec3(direction_x[p], direction_y[p], direction_z[p]),
+                   time[p]);
+    }
+
+    void set_ray(uint32_t p, const ray& r)
+    {
+        origin_x[p] = r.orig.x;
+        origin_y[p] = r.orig.y;
+        origin_z[p] = r.orig.z;
+        direction_x[p] = r.dir.x;
+        direction_y[p] = r.dir.y;
+        direction_z[p] = r.dir.z;
+        time[p] = r.time();
+    }
+
+    // orders the paths of queue, active or shadowed, by key(p), which is in [0, n_keys), keeping the order of paths
+    // with the same key
+    template<class Key>
+    void sort(std::vector<uint32_t>& queue, uint32_t n_keys, Key&& key)
+    {
+        key_start.assign(n_keys + 1, 0);
+        for (uint32_t p : queue)
+            key_start[key(p) + 1]++;
+        for (uint32_t k = 1; k <= n_keys; ++k)
+            key_start[k] += key_start[k - 1];
+        sorted.resize(queue.size());
+        for (uint32_t p : queue)
+            sorted[key_start[key(p)]++] = p;
+        queue.swap(sorted);
+    }
+};
+
+// The pdf of sampling direction v from o toward lights and reaching the surface at distance t along it: the pdf of
+// each light whose own shape the ray meets there, as hittable_list::pdf_value weighs them.
+static float
+light_surface_pdf(const hittable_list& lights, const point3& o, const vec3& v, float t)
+{
+    if (lights.objects.empty())
+        return 0.0f;
+    ray r(o, v);
+    float sum = 0.0f;
+    for (const auto& light : lights.objects) {
+        float light_t;
+        if (light->intersect_t(r, RAY_EPSILON, infinity, light_t) &&
+            std::fabs(light_t - t) <= light_surface_tolerance * light_t)
+            sum += light->pdf_value(o, v);
+    }
+    return sum / lights.objects.size();
+}
+
+// Traces the same paths as path_color does, but a stage at a time over all the paths of a wave: generate the camera
+// rays, then extend every path by a segment, shade every hit and connect the light samples it took, over and over
+// until no path is left, then accumulate the samples into their pixels. Rays are sorted by direction octant before
+// they are traced and hits by material before they are shaded, so that each stage keeps running the same code over
+// similar data. Every path keeps its own rng and sampler state, and the samples of a pixel are added in order.
+//
+// With lights, every diffuse bounce also samples a point on one of them, and the connect stage asks, for all of the
+// bounce's samples at once, whether anything is in the way before it looks up the light's emission. Light samples
+// and emitters the path finds by itself are weighed against each other by the balance heuristic, so the image
+// converges to the same one as path_color's with less noise. Returns the samples taken.
+uint64_t
+render_tile_wavefront(const hittable_list& world,
+                      const shared_ptr<hittable_list>& lights,
+                      const material_table& materials,
+                      const camera& cam,
+                      accumulation_buffer& film,
+                      const render_settings& rs,
+                      color background,
+                      int last_sample,
+                      int xstart,
+                      int ystart,
+                      int xend,
+                      int yend,
+                      sampler& smp)
+{
+    static thread_local wavefront_paths paths;
+    paths.pixels.clear();
+    for (int j = yend - 1; j >= ystart; --j) {
+        for (int i = xstart; i < xend; ++i) {
+            auto& pixel = film.at(i, j);
+            if (pixel.converged || pixel.samples >= last_sample)
+                continue;
+            color sum(0.0f, 0.0f, 0.0f);
+            paths.pixels.push_back({ &pixel, i, j, pixel.samples, pixel.samples, sum, false });
+        }
+    }
+    if (paths.pixels.empty())
+        return 0;
+    int wave_samples = std::max(1, wavefront_size / static_cast<int>(paths.pixels.size()));
+    const uint32_t n_material_keys = static_cast<uint32_t>(materials.size()) + 1;
+
+    while (true) {
+        // generate: the next wave_samples samples of every pixel that is not done yet, pixel by pixel
+        paths.clear();
+        for (uint32_t px = 0; px < paths.pixels.size(); ++px) {
+            const auto& tp = paths.pixels[px];
+            if (tp.done)
+                continue;
+            int end = std::min(tp.s + wave_samples, last_sample);
+            for (int s = tp.s; s < end; ++s) {
+                ray r = camera_sample(cam, rs, smp, tp.i, tp.j, s);
+                if (rs.max_path_size > 0)
+                    paths.active.push_back(static_cast<uint32_t>(paths.size()));
+                paths.add(px, s, r, thread_rng(), smp.next_dimension());
+            }
+        }
+        if (paths.size() == 0)
+            break;
+
+        while (!paths.active.empty()) {
+            // extend: trace the next segment of every path, in groups of rays headed the same way
+            paths.sort(paths.active, 8, [&](uint32_t p) {
+                return (paths.direction_x[p] < 0.0f) | (paths.direction_y[p] < 0.0f) << 1 |
+                       (paths.direction_z[p] < 0.0f) << 2;
+            });
+            for (uint32_t p : paths.active) {
+                // media draw their scattering distance while they are traced
+                thread_rng() = paths.rng[p];
+                thread_ray_count++;
+                paths.hit[p] = world.hit(paths.path_ray(p), RAY_EPSILON, infinity, paths.rec[p]);
+                paths.rng[p] = thread_rng();
+            }
+
+            // shade: misses first, then the hits material by material; paths that go on stay in active
+            paths.sort(paths.active, n_material_keys, [&](uint32_t p) {
+                return paths.hit[p] ? paths.rec[p].mat_id + 1 : 0;
+            });
+            size_t n_active = 0;
+            for (uint32_t p : paths.active) {
+                color& attenuation = paths.attenuation[p];
+                color& radiance = paths.radiance[p];
+                if (!paths.hit[p]) {
+                    radiance += attenuation * background;
+                    continue;
+                }
+
+                const auto& tp = paths.pixels[paths.pixel[p]];
+                thread_rng() = paths.rng[p];
+                smp.resume_pixel_sample(tp.i, tp.j, paths.sample[p], paths.dimension[p]);
+
+                ray path_ray = paths.path_ray(p);
+                const hit_record& rec = paths.rec[p];
+                const material& mat = materials[rec.mat_id];
+                scatter_record srec;
+                color emitted = mat.emitted(path_ray, rec, rec.u, rec.v, rec.p);
+                // an emitter a light sample could have reached as well only gets its share of the two
+                float segment_pdf = paths.scatter_pdf[p];
+                if (segment_pdf > 0.0f && emitted != color(0.0f, 0.0f, 0.0f)) {
+                    float light_pdf = light_surface_pdf(*lights, path_ray.origin(), path_ray.direction(), rec.t);
+                    emitted *= segment_pdf / (segment_pdf + light_pdf);
+                }
+                paths.scatter_pdf[p] = 0.0f;
+                bool goes_on = mat.scatter(path_ray, rec, srec);
+                if (!goes_on) {
+                    radiance += attenuation * emitted;
+                } else if (srec.is_specular) {
+                    attenuation *= srec.attenuation;
+                    paths.set_ray(p, srec.specular_ray);
+                } else {
+                    float choose = smp.get_1d();
+                    vec2 u = smp.get_2d();
+                    ray scattered;
+                    float pdf_val;
+                    radiance += attenuation * emitted;
+                    if (lights) {
+                        mixture_pdf mixture(hittable_pdf(*lights, rec.p), srec.scatter_pdf);
+                        scattered = ray(rec.p, mixture.generate(choose, u), path_ray.time());
+                        pdf_val = mixture.value(scattered.direction());
+                        paths.scatter_pdf[p] = pdf_val;
+
+                        // a light sample, for the connect stage; its distance is to the shape of the light picked
+                        size_t light;
+                        vec3 toward = lights->random(rec.p, smp.get_2d(), light);
+                        ray shadow(rec.p, toward, path_ray.time());
+                        float light_t;
+                        color weight = attenuation * srec.attenuation * mat.scattering_pdf(path_ray, rec, shadow);
+                        if (weight != color(0.0f, 0.0f, 0.0f) &&
+                            lights->objects[light]->intersect_t(shadow, RAY_EPSILON, infinity, light_t)) {
+                            paths.shadow_x[p] = toward.x;
+                            paths.shadow_y[p] = toward.y;
+                            paths.shadow_z[p] = toward.z;
+                            paths.shadow_t[p] = light_t;
+                            paths.shadow_weight[p] = weight;
+                            paths.shadow_pdf[p] = mixture.value(toward);
+                            paths.shadowed.push_back(p);
+                        }
+                    } else {
+                        scattered = ray(rec.p, srec.scatter_pdf.generate(u), path_ray.time());
+                        pdf_val = srec.scatter_pdf.value(scattered.direction());
+                    }
+                    attenuation *= srec.attenuation * mat.scattering_pdf(path_ray, rec, scattered) / pdf_val;
+                    paths.set_ray(p, scattered);
+                }
+
+                // Russian roulette, as in path_color; the light sample already taken still counts
+                if (goes_on && paths.bounce[p] + 1 >= roulette_min_bounces) {
+                    float survive = std::min(std::max(attenuation.x, std::max(attenuation.y, attenuation.z)), 0.95f);
+                    if (smp.get_1d() < survive)
+                        attenuation /= survive;
+                    else
+                        goes_on = false;
+                }
+
+                paths.rng[p] = thread_rng();
+                paths.dimension[p] = smp.next_dimension();
+                if (goes_on && ++paths.bounce[p] < rs.max_path_size)
+                    paths.active[n_active++] = p;
+            }
+            paths.active.resize(n_active);
+
+            // connect: the light samples of the bounce, in groups of rays headed the same way, from where the paths
+            // now start. Each only has to know whether anything is in the way up to the light; the ones that get
+            // through look up what emits just there, which is the light unless the scene's shape for it is off
+            paths.sort(paths.shadowed, 8, [&](uint32_t p) {
+                return (paths.shadow_x[p] < 0.0f) | (paths.shadow_y[p] < 0.0f) << 1 | (paths.shadow_z[p] < 0.0f) << 2;
+            });
+            for (uint32_t p : paths.shadowed) {
+                point3 origin(paths.origin_x[p], paths.origin_y[p], paths.origin_z[p]);
+                ray shadow(origin, vec3(paths.shadow_x[p], paths.shadow_y[p], paths.shadow_z[p]), paths.time[p]);
+                float light_t = paths.shadow_t[p];
+                float near = light_t * (1.0f - light_surface_tolerance);
+                float far = light_t * (1.0f + light_surface_tolerance);
+                thread_rng() = paths.rng[p];
+                thread_ray_count++;
+                hit_record light_rec;
+                if (!world.occluded(shadow, RAY_EPSILON, near) && world.hit(shadow, near, far, light_rec)) {
+                    const material& light_mat = materials[light_rec.mat_id];
+                    color emitted = light_mat.emitted(shadow, light_rec, light_rec.u, light_rec.v, light_rec.p);
+                    float light_pdf = light_surface_pdf(*lights, origin, shadow.direction(), light_rec.t);
+                    paths.radiance[p] += paths.shadow_weight[p] * emitted / (light_pdf + paths.shadow_pdf[p]);
+                }
+                paths.rng[p] = thread_rng();
+            }
+            paths.shadowed.clear();
+        }
+
+        // accumulate: the paths are in the order they were generated in, so each pixel gets its samples in order, and
+        // the ones past where adaptive sampling stops it are dropped
+        for (uint32_t p = 0; p < paths.size(); ++p) {
+            auto& tp = paths.pixels[paths.pixel[p]];
+            if (tp.done)
+                continue;
+            tp.sum += paths.radiance[p];
+            ++tp.s;
+            if (adaptive_converged(*tp.pixel, paths.radiance[p], tp.s, rs) || tp.s >= last_sample)
+                tp.done = true;
+        }
+    }
+
+    uint64_t tile_samples = 0;
+    for (const auto& tp : paths.pixels) {
+        tp.pixel->sum += tp.sum;
+        tp.pixel->samples += tp.s - tp.first_sample;
+        tile_samples += tp.s - tp.first_sample;
+    }
+    return tile_samples;
+}
+
+// brings every pixel of the tile that adaptive sampling has not stopped yet up to last_sample samples, adding them to
+// film
 bool
 render_tile(const hittable_list& world,
             const shared_ptr<hittable_list>& lights,
+            const material_table& materials,
             const camera& cam,
-            imageBuffer* image,
+            accumulation_buffer& film,
             const render_settings& rs,
             color background,
+            int last_sample,
             int xoffset,
             int yoffset,
             int tilewidth,
@@ -146,32 +898,197 @@ render_tile(const hittable_list& world,
     int yend = yoffset + tileheight;
     int xstart = xoffset;
     int xend = xoffset + tilewidth;
+    uint64_t tile_samples = 0;
+    auto smp = make_sampler(rs.sampler, rs.samples_per_pixel);
+
+    if (rs.integrator == integrator_type::wavefront) {
+        tile_samples = render_tile_wavefront(
+          world, lights, materials, cam, film, rs, background, last_sample, xstart, ystart, xend, yend, *smp);
+    } else if (rs.packet_width > 0) {
+        tile_samples = render_tile_packets(
+          world, lights, materials, cam, film, rs, background, last_sample, xstart, ystart, xend, yend, *smp);
+    } else {
+        for (int j = yend - 1; j >= ystart; --j) {
+            for (int i = xstart; i < xend; ++i) {
+                auto& pixel = film.at(i, j);
+                if (pixel.converged)
+                    continue;
+
+                color pixel_color(0.0f, 0.0f, 0.0f);
+                int first_sample = pixel.samples;
+                int s = first_sample;
+                while (s < last_sample) {
+                    ray r = camera_sample(cam, rs, *smp, i, j, s);
+                    color sample;
+                    if (rs.integrator == integrator_type::recursive)
+                        sample = ray_color(r, background, world, lights, materials, *smp, rs.max_path_size);
+                    else
+                        sample = path_color(r, background, world, lights, materials, *smp, rs.max_path_size);
+                    pixel_color += sample;
+                    ++s;
+
+                    if (adaptive_converged(pixel, sample, s, rs))
+                        break;
+                }
+
+                pixel.sum += pixel_color;
+                pixel.samples += s - first_sample;
+                tile_samples += s - first_sample;
+            }
+        }
+    }
+
+    total_rays += thread_ray_count;
+    thread_ray_count = 0;
+    total_samples += tile_samples;
 
     std::stringstream stream; // #include <sstream> for this
-    stream << "Start tile " << xstart << "," << ystart << "-" << xend << "," << yend << std::endl;
+    stream << "\rPass " << current_pass << ", tiles done " << ++tiles_done << " / " << tiles_total << std::flush;
     std::cerr << stream.str();
 
-    for (int j = yend - 1; j >= ystart; --j) {
-        for (int i = xstart; i < xend; ++i) {
+    return true;
+}
+
+// resolves film into image and writes it as a png
+void
+write_image(const std::string& filename, const accumulation_buffer& film, imageBuffer& image)
+{
+    film.resolve(image);
+    stbi_flip_vertically_on_write(1);
+    stbi_write_png(filename.c_str(), image.w, image.h, 3, image.data, 3 * image.w);
+}
 
-            color pixel_color(0.0f, 0.0f, 0.0f);
-            for (int s = 0; s < rs.samples_per_pixel; ++s) {
-                auto u = (i + random_float()) / (rs.image_width - 1);
-                auto v = (j + random_float()) / (rs.image_height - 1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, lights, rs.max_path_size);
-                // pixel_color += path_color(r, background, world, lights, rs.max_path_size);
+// writes the samples taken per pixel as a png, shading from blue for none to red for samples_per_pixel
+void
+write_sample_heatmap(const std::string& filename, const std::vector<int>& sample_counts, const render_settings& rs)
+{
+    std::vector<uint8_t> pixels(sample_counts.size() * 3);
+    for (size_t p = 0; p < sample_counts.size(); ++p) {
+        float t = float(sample_counts[p]) / rs.samples_per_pixel;
+        color c(t, 1.0f - std::fabs(2.0f * t - 1.0f), 1.0f - t);
+        pixels[p * 3 + 0] = static_cast<uint8_t>(255.999f * c.x);
+        pixels[p * 3 + 1] = static_cast<uint8_t>(255.999f * c.y);
+        pixels[p * 3 + 2] = static_cast<uint8_t>(255.999f * c.z);
+    }
+    stbi_write_png(filename.c_str(), rs.image_width, rs.image_height, 3, pixels.data(), 3 * rs.image_width);
+}
+
+// traces rays, one per pixel of a width x height image, through tree in packets of rs.packet_width rays from blocks of
+// neighbouring pixels, as render_tile_packets does; returns how many hit something
+int
+trace_packets(const bvh_node& tree, const std::vector<ray>& rays, int width, int height, const render_settings& rs)
+{
+    int block_width = rs.packet_width >= 8 ? 4 : 2;
+    int block_height = rs.packet_width / block_width;
+    ray_packet packet;
+    int hits = 0;
+    for (int by = 0; by < height; by += block_height) {
+        for (int bx = 0; bx < width; bx += block_width) {
+            packet.clear();
+            uint32_t lanes = 0;
+            int n_lanes = 0;
+            for (int j = by; j < by + block_height && j < height; ++j) {
+                for (int i = bx; i < bx + block_width && i < width; ++i) {
+                    packet.set_ray(n_lanes, rays[static_cast<size_t>(j) * width + i]);
+                    lanes |= 1u << n_lanes++;
+                }
             }
+            tree.intersect_packet(packet, lanes);
+            packet.fill_records();
+            for (uint32_t hit = packet.hit_lanes; hit != 0; hit &= hit - 1)
+                hits++;
+        }
+    }
+    return hits;
+}
 
-            image->putPixel(rs.samples_per_pixel, pixel_color, i, j);
+// builds a tree over the scene with every split method and width and traces one camera ray per pixel through each,
+// on this thread, to compare build and trace times; with rs.packet_width also in packets of that many rays
+void
+benchmark_bvh(const hittable_list& world, const camera& cam, const render_settings& rs)
+{
+    // the same rays for every tree
+    seed_thread_rng(0, 0);
+    std::vector<ray> rays;
+    rays.reserve(static_cast<size_t>(rs.image_width) * rs.image_height);
+    for (int j = 0; j < rs.image_height; ++j) {
+        for (int i = 0; i < rs.image_width; ++i) {
+            auto u = (i + 0.5f) / rs.image_width;
+            auto v = (j + 0.5f) / rs.image_height;
+            rays.push_back(cam.get_ray(u, v));
         }
     }
 
-    std::stringstream stream2; // #include <sstream> for this
-    stream2 << "End tile " << xstart << "," << ystart << "-" << xend << "," << yend << std::endl;
-    std::cerr << stream2.str();
+    const std::pair<const char*, bvh_split_method> methods[] = { { "median", bvh_split_method::median },
+                                                                 { "sah", bvh_split_method::sah },
+                                                                 { "lbvh", bvh_split_method::lbvh } };
+    for (const auto& method : methods) {
+        for (int width : { 2, 4, 8 }) {
+            bvh_build_options options = rs.bvh;
+            options.split_method = method.second;
+            options.width = width;
+            bvh_node tree(world, 0.0f, 1.0f, options);
 
-    return true;
+            int hits = 0;
+            auto trace_start = std::chrono::high_resolution_clock::now();
+            for (const ray& r : rays) {
+                hit_record rec;
+                if (tree.hit(r, RAY_EPSILON, infinity, rec))
+                    hits++;
+            }
+            auto trace_end = std::chrono::high_resolution_clock::now();
+            auto trace_ms = std::chrono::duration<float, std::milli>(trace_end - trace_start).count();
+
+            std::cerr << method.first << " x" << width << ": build = " << tree.stats.build_ms << " ms ("
+                      << tree.stats.nodes << " nodes, depth " << tree.stats.depth << "), trace = " << trace_ms
+                      << " ms for " << rays.size() << " rays (" << hits
+                      << " hits), expected SAH cost = " << tree.sah_cost() << std::endl;
+
+            if (rs.packet_width > 0) {
+                auto packet_start = std::chrono::high_resolution_clock::now();
+                int packet_hits = trace_packets(tree, rays, rs.image_width, rs.image_height, rs);
+                auto packet_end = std::chrono::high_resolution_clock::now();
+                auto packet_ms = std::chrono::duration<float, std::milli>(packet_end - packet_start).count();
+                std::cerr << "    packets of " << rs.packet_width << ": trace = " << packet_ms << " ms ("
+                          << packet_hits << " hits), " << trace_ms / packet_ms << "x" << std::endl;
+            }
+        }
+    }
+}
+
+// Tile coordinates in the order they are rendered: along a Hilbert curve over the tile grid, so that tiles
+// rendered at around the same time are close together and touch mostly the same parts of the scene.
+std::vector<std::pair<int, int>>
+hilbert_tile_order(int n_x_tiles, int n_y_tiles)
+{
+    int n = 1;
+    while (n < n_x_tiles || n < n_y_tiles) {
+        n *= 2;
+    }
+
+    std::vector<std::pair<int, int>> order;
+    order.reserve(n_x_tiles * n_y_tiles);
+    for (int d = 0; d < n * n; ++d) {
+        // walk the curve over the n x n grid and keep the points that fall on a tile
+        int x = 0;
+        int y = 0;
+        for (int s = 1, t = d; s < n; s *= 2, t /= 4) {
+            int rx = 1 & (t / 2);
+            int ry = 1 & (t ^ rx);
+            if (ry == 0) {
+                if (rx == 1) {
+                    x = s - 1 - x;
+                    y = s - 1 - y;
+                }
+                std::swap(x, y);
+            }
+            x += s * rx;
+            y += s * ry;
+        }
+        if (x < n_x_tiles && y < n_y_tiles)
+            order.emplace_back(x, y);
+    }
+    return order;
 }
 
 int
@@ -179,8 +1096,98 @@ main(int argc, char** argv)
 {
     argparse::ArgumentParser program("RAY G BIV");
 
-    // single unnamed integer argument for scene number
-    program.add_argument("scene").help("select scene number").scan<'i', int>();
+    // single unnamed argument for the scene
+    program.add_argument("scene").help("scene file, or the number of one in the scenes directory (1 to 10)");
+    program.add_argument("--threads")
+      .help("render threads, 0 for all cores")
+      .default_value(0)
+      .scan<'i', int>();
+    program.add_argument("--tile-size")
+      .help("edge length in pixels of the tiles the image is split into")
+      .default_value(32)
+      .scan<'i', int>();
+    program.add_argument("--adaptive")
+      .help("stop sampling a pixel at this relative error of its mean luminance, 0 for a fixed sample count")
+      .default_value(0.0f)
+      .scan<'g', float>();
+    program.add_argument("--min-samples")
+      .help("samples every pixel gets before adaptive sampling may stop it")
+      .default_value(16)
+      .scan<'i', int>();
+    program.add_argument("--max-samples")
+      .help("samples per pixel at most, 0 for the scene's own count")
+      .default_value(0)
+      .scan<'i', int>();
+    program.add_argument("--heatmap")
+      .help("also write the number of samples taken in each pixel to this png")
+      .default_value(std::string(""));
+    program.add_argument("--pass-samples")
+      .help("samples each pixel gets per pass over the image, 0 for all of them in one pass, or a sixteenth of them "
+            "with a --time-budget or --checkpoint")
+      .default_value(0)
+      .scan<'i', int>();
+    program.add_argument("--time-budget")
+      .help("seconds after which no more passes or tiles are started, 0 for no limit")
+      .default_value(0.0f)
+      .scan<'g', float>();
+    program.add_argument("--preview")
+      .help("rewrite the image so far to this png after every pass")
+      .default_value(std::string(""));
+    program.add_argument("--checkpoint")
+      .help("file the render is saved to every so often, and at the end, so it can be resumed")
+      .default_value(std::string(""));
+    program.add_argument("--checkpoint-every")
+      .help("seconds between checkpoints")
+      .default_value(60.0f)
+      .scan<'g', float>();
+    program.add_argument("--resume")
+      .help("carry on from the --checkpoint file, if there is one")
+      .default_value(false)
+      .implicit_value(true);
+    program.add_argument("--float-output")
+      .help("also write the unclamped linear image to this .exr or .pfm file")
+      .default_value(std::string(""));
+    program.add_argument("--exr-pixels")
+      .help("precision of the exr channels: half or float")
+      .default_value(std::string("half"));
+    program.add_argument("--exr-compression")
+      .help("compression of the exr rows: none, rle, zips or zip")
+      .default_value(std::string("zip"));
+    program.add_argument("--sampler")
+      .help("where path samples come from: independent, stratified, sobol or bluenoise")
+      .default_value(std::string("sobol"));
+    program.add_argument("--integrator")
+      .help("path: iterative with Russian roulette, recursive: every path to its full length, wavefront: traces "
+            "many paths of a tile a stage at a time, with a shadow-ray light sample at every diffuse bounce, "
+            "weighted by MIS")
+      .default_value(std::string("path"));
+    program.add_argument("--bvh")
+      .help("acceleration structure split method: none, median, sah or lbvh")
+      .default_value(std::string("sah"));
+    program.add_argument("--bvh-bins")
+      .help("centroid bins per axis for the sah split")
+      .default_value(12)
+      .scan<'i', int>();
+    program.add_argument("--bvh-leaf-size")
+      .help("maximum objects per leaf for the sah split")
+      .default_value(4)
+      .scan<'i', int>();
+    program.add_argument("--bvh-width")
+      .help("children per acceleration structure node: 2, 4 or 8")
+      .default_value(2)
+      .scan<'i', int>();
+    program.add_argument("--bvh-benchmark")
+      .help("time building and tracing the scene with every split method instead of rendering it")
+      .default_value(false)
+      .implicit_value(true);
+    program.add_argument("--bvh-threads")
+      .help("threads used to build the acceleration structure, 0 for all cores")
+      .default_value(0)
+      .scan<'i', int>();
+    program.add_argument("--packet")
+      .help("camera rays traced together through the scene: 4, 8 or 16, or 0 for one at a time")
+      .default_value(0)
+      .scan<'i', int>();
 
     try {
         program.parse_args(argc, argv);
@@ -190,62 +1197,294 @@ main(int argc, char** argv)
         return 1;
     }
 
-    auto iscene = program.get<int>("scene");
+    auto scene_file = program.get<std::string>("scene");
+    bool scene_number = !scene_file.empty() && std::all_of(scene_file.begin(), scene_file.end(), [](char c) {
+        return c >= '0' && c <= '9';
+    });
+    if (scene_number) {
+        auto builtin = builtin_scene_file(std::atoi(scene_file.c_str()), argc > 0 ? argv[0] : "");
+        if (builtin.empty()) {
+            std::cerr << "No scene " << scene_file << std::endl;
+            std::cerr << program;
+            return 1;
+        }
+        scene_file = builtin;
+    }
 
     color background(0, 0, 0);
     render_settings rs;
+
+    auto integrator = program.get<std::string>("--integrator");
+    if (integrator == "path") {
+        rs.integrator = integrator_type::path;
+    } else if (integrator == "recursive") {
+        rs.integrator = integrator_type::recursive;
+    } else if (integrator == "wavefront") {
+        rs.integrator = integrator_type::wavefront;
+    } else {
+        std::cerr << "Unknown integrator '" << integrator << "'" << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    auto sampler_name = program.get<std::string>("--sampler");
+    if (sampler_name == "independent") {
+        rs.sampler = sampler_type::independent;
+    } else if (sampler_name == "stratified") {
+        rs.sampler = sampler_type::stratified;
+    } else if (sampler_name == "sobol") {
+        rs.sampler = sampler_type::sobol;
+    } else if (sampler_name == "bluenoise") {
+        rs.sampler = sampler_type::blue_noise;
+    } else {
+        std::cerr << "Unknown sampler '" << sampler_name << "'" << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    auto float_file = program.get<std::string>("--float-output");
+    auto has_extension = [](const std::string& name, const std::string& extension) {
+        return name.size() >= extension.size() &&
+               name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+    };
+    bool float_exr = has_extension(float_file, ".exr");
+    if (!float_file.empty() && !float_exr && !has_extension(float_file, ".pfm")) {
+        std::cerr << "Float output '" << float_file << "' is neither .exr nor .pfm" << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    auto exr_pixels = program.get<std::string>("--exr-pixels");
+    exr_pixel_type exr_type = exr_pixel_type::half;
+    if (exr_pixels == "float") {
+        exr_type = exr_pixel_type::float32;
+    } else if (exr_pixels != "half") {
+        std::cerr << "Unknown exr pixel type '" << exr_pixels << "'" << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    const std::pair<const char*, exr_compression> compressions[] = { { "none", exr_compression::none },
+                                                                     { "rle", exr_compression::rle },
+                                                                     { "zips", exr_compression::zips },
+                                                                     { "zip", exr_compression::zip } };
+    auto compression_name = program.get<std::string>("--exr-compression");
+    auto compression = std::find_if(std::begin(compressions), std::end(compressions), [&](const auto& c) {
+        return compression_name == c.first;
+    });
+    if (compression == std::end(compressions)) {
+        std::cerr << "Unknown exr compression '" << compression_name << "'" << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    auto bvh_method = program.get<std::string>("--bvh");
+    bool use_bvh = bvh_method != "none";
+    if (bvh_method == "median") {
+        rs.bvh.split_method = bvh_split_method::median;
+    } else if (bvh_method == "sah" || !use_bvh) {
+        rs.bvh.split_method = bvh_split_method::sah;
+    } else if (bvh_method == "lbvh") {
+        rs.bvh.split_method = bvh_split_method::lbvh;
+    } else {
+        std::cerr << "Unknown bvh split method '" << bvh_method << "'" << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    rs.bvh.sah_bins = program.get<int>("--bvh-bins");
+    rs.bvh.max_leaf_size = program.get<int>("--bvh-leaf-size");
+    rs.bvh.threads = program.get<int>("--bvh-threads");
+    rs.bvh.width = program.get<int>("--bvh-width");
+    if (rs.bvh.width != 2 && rs.bvh.width != 4 && rs.bvh.width != 8) {
+        std::cerr << "Unsupported bvh width " << rs.bvh.width << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    rs.packet_width = program.get<int>("--packet");
+    if (rs.packet_width != 0 && rs.packet_width != 4 && rs.packet_width != 8 && rs.packet_width != 16) {
+        std::cerr << "Unsupported packet width " << rs.packet_width << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
     hittable_list world;
     shared_ptr<hittable_list> lights = make_shared<hittable_list>();
+    material_table materials;
     camera cam;
 
-    load_scene(iscene, rs, world, lights, cam, background);
+    uint64_t scene_hash = 0;
+    if (!load_scene(scene_file, rs, world, lights, materials, cam, background, scene_hash))
+        return 1;
+    rs.tile_size = std::max(1, program.get<int>("--tile-size"));
+    if (program.get<int>("--max-samples") > 0) {
+        rs.samples_per_pixel = program.get<int>("--max-samples");
+    }
+    rs.adaptive_error = program.get<float>("--adaptive");
+    rs.min_samples = std::max(1, program.get<int>("--min-samples"));
 
     if (lights->size() == 0) {
         lights = nullptr;
     }
+
+    if (program.get<bool>("--bvh-benchmark")) {
+        benchmark_bvh(world, cam, rs);
+        return 0;
+    }
+
+    if (use_bvh) {
+        // replace the flat top level list with a single tree over all of its objects
+        auto tree = make_shared<bvh_node>(world, 0.0f, 1.0f, rs.bvh);
+        const auto& stats = tree->stats;
+        std::cerr << "BVH (" << bvh_method << ") build = " << stats.build_ms << " ms on " << stats.threads
+                  << " threads, " << stats.nodes << " " << stats.width << "-wide nodes (" << stats.leaves
+                  << " leaves), depth " << stats.depth << ", expected SAH cost = " << tree->sah_cost() << std::endl;
+        world = hittable_list(tree);
+    }
     // uint8_t* image = new uint8_t[rs.image_width * rs.image_height * 3];
     imageBuffer* image = new imageBuffer(rs.image_width, rs.image_height);
+    accumulation_buffer film(rs.image_width, rs.image_height);
 
     // Render
     auto start = std::chrono::high_resolution_clock::now();
+#ifdef RAYGBIV_COUNT_ALLOCATIONS
+    uint64_t allocations_before_render = heap_allocations;
+#endif
 
     unsigned int number_of_cores = std::thread::hardware_concurrency();
+    if (program.get<int>("--threads") > 0) {
+        number_of_cores = program.get<int>("--threads");
+    }
 
-    std::vector<std::future<bool>> jobs;
-    raygbiv::Tasks tasks;
-    // divide image into a set of tiles to run per thread.
-    int n_x_tiles = 4;
-    int n_y_tiles = 4;
-    for (int i = 0; i < n_y_tiles; ++i) {
-        for (int j = 0; j < n_x_tiles; ++j) {
-
-            int xoffset = j * rs.image_width / n_x_tiles;
-            int yoffset = i * rs.image_height / n_y_tiles;
-            int tilewidth = rs.image_width / n_x_tiles;
-            int tileheight = rs.image_height / n_y_tiles;
-            if (xoffset + tilewidth > rs.image_width) {
-                tilewidth = rs.image_width - xoffset;
-            }
-            if (yoffset + tileheight > rs.image_height) {
-                tileheight = rs.image_height - yoffset;
+    // time running out leaves the tiles of the pass that are not started yet without its samples, and checkpoints
+    // are only taken between passes, so with either of them passes default to a sixteenth of the samples: short
+    // enough to stop or checkpoint often, without a pass over every tile for each single sample
+    float time_budget = program.get<float>("--time-budget");
+    auto checkpoint_file = program.get<std::string>("--checkpoint");
+    int pass_samples = program.get<int>("--pass-samples");
+    if (pass_samples <= 0) {
+        pass_samples = time_budget > 0.0f || !checkpoint_file.empty() ? std::max(1, rs.samples_per_pixel / 16)
+                                                                       : rs.samples_per_pixel;
+    }
+    auto deadline = start + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                              std::chrono::duration<float>(time_budget));
+    auto out_of_time = [&] { return time_budget > 0.0f && std::chrono::high_resolution_clock::now() >= deadline; };
+    auto preview_file = program.get<std::string>("--preview");
+
+    auto checkpoint = make_checkpoint_settings(scene_hash, rs, pass_samples);
+    // the passes carry on from the first one some pixel still needs
+    int first_pass_sample = 0;
+    if (program.get<bool>("--resume")) {
+        if (checkpoint_file.empty()) {
+            std::cerr << "--resume needs a --checkpoint file" << std::endl;
+            return 1;
+        }
+        std::ifstream exists(checkpoint_file);
+        if (exists) {
+            if (!read_checkpoint(checkpoint_file, checkpoint, film)) {
+                std::cerr << "Checkpoint " << checkpoint_file
+                          << " is damaged or was written with other settings, not resuming" << std::endl;
+                return 1;
             }
+            int fewest = film.fewest_samples();
+            first_pass_sample = fewest == INT_MAX ? rs.samples_per_pixel : fewest - fewest % pass_samples;
+            std::cerr << "Resuming from " << checkpoint_file << " at sample " << first_pass_sample << std::endl;
+        } else {
+            std::cerr << "No checkpoint " << checkpoint_file << " yet, starting from the beginning" << std::endl;
+        }
+    }
+    std::unique_ptr<checkpoint_writer> checkpoints;
+    if (!checkpoint_file.empty()) {
+        checkpoints = std::make_unique<checkpoint_writer>(checkpoint_file, checkpoint);
+    }
+    auto checkpoint_interval = std::chrono::duration<float>(program.get<float>("--checkpoint-every"));
+    auto last_checkpoint = std::chrono::high_resolution_clock::now();
+
+    raygbiv::Tasks tasks;
+    tasks.start(number_of_cores);
+    // divide the image into many small tiles, so that every thread stays busy to the end even when some parts of
+    // the image are much more expensive than others
+    int n_x_tiles = (rs.image_width + rs.tile_size - 1) / rs.tile_size;
+    int n_y_tiles = (rs.image_height + rs.tile_size - 1) / rs.tile_size;
+    tiles_total = n_x_tiles * n_y_tiles;
+    auto tiles = hilbert_tile_order(n_x_tiles, n_y_tiles);
+    // every pass adds the next pass_samples samples to each pixel, so the image keeps improving evenly and can be
+    // stopped after any of them
+    for (int first_sample = first_pass_sample; first_sample < rs.samples_per_pixel && !out_of_time();
+         first_sample += pass_samples) {
+        int last_sample = std::min(first_sample + pass_samples, rs.samples_per_pixel);
+        current_pass++;
+        tiles_done = 0;
+        std::vector<std::future<bool>> jobs;
+        for (const auto& tile : tiles) {
+            int xoffset = tile.first * rs.tile_size;
+            int yoffset = tile.second * rs.tile_size;
+            int tilewidth = std::min(rs.tile_size, rs.image_width - xoffset);
+            int tileheight = std::min(rs.tile_size, rs.image_height - yoffset);
             jobs.push_back(tasks.queue(
-              [&world, &lights, &cam, image, &rs, background, xoffset, yoffset, tilewidth, tileheight]() -> bool {
-                  return render_tile(
-                    world, lights, cam, image, rs, background, xoffset, yoffset, tilewidth, tileheight);
+              [&, background, last_sample, xoffset, yoffset, tilewidth, tileheight]() -> bool {
+                  // the tiles a pass has not started when time runs out are left as they were
+                  if (out_of_time())
+                      return false;
+                  return render_tile(world,
+                                     lights,
+                                     materials,
+                                     cam,
+                                     film,
+                                     rs,
+                                     background,
+                                     last_sample,
+                                     xoffset,
+                                     yoffset,
+                                     tilewidth,
+                                     tileheight);
               }));
         }
+        std::for_each(jobs.begin(), jobs.end(), [](auto& x) { x.get(); });
+
+        if (!preview_file.empty()) {
+            write_image(preview_file, film, *image);
+        }
+        // a checkpoint still being written makes this pass skip its turn rather than wait
+        auto now = std::chrono::high_resolution_clock::now();
+        if (checkpoints && now - last_checkpoint >= checkpoint_interval && checkpoints->write_async(film)) {
+            last_checkpoint = now;
+        }
+    }
+    // the last checkpoint has everything, so a render stopped by its time budget can go on from there
+    if (checkpoints) {
+        checkpoints->wait();
+        if (!write_checkpoint(checkpoint_file, checkpoint, film)) {
+            std::cerr << "\nCould not write checkpoint " << checkpoint_file << std::endl;
+        }
     }
-    tasks.start(number_of_cores);
-    std::for_each(jobs.begin(), jobs.end(), [](auto& x) { x.get(); });
 
     auto end = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
     std::cerr << "\nRender duration = " << duration.count() / 1000.f << " s" << std::endl;
+    std::cerr << "Rays traced = " << total_rays << " (" << total_rays / (duration.count() * 1000.f) << " Mrays/s)"
+              << std::endl;
+    double pixels = double(rs.image_width) * rs.image_height;
+    std::cerr << "Samples = " << total_samples << " (" << total_samples / pixels << " per pixel, in " << current_pass
+              << " passes)" << std::endl;
+#ifdef RAYGBIV_COUNT_ALLOCATIONS
+    uint64_t render_allocations = heap_allocations - allocations_before_render;
+    double samples = double(total_samples);
+    std::cerr << "Heap allocations = " << render_allocations << " (" << render_allocations / samples << " per sample)"
+              << std::endl;
+#endif
     std::cerr << "\nRender Done.\n";
 
-    stbi_flip_vertically_on_write(1);
-    stbi_write_png("out.png", rs.image_width, rs.image_height, 3, image->data, 3 * rs.image_width);
+    write_image("out.png", film, *image);
+    if (!float_file.empty()) {
+        bool written = float_exr ? write_exr(float_file, film, exr_type, compression->second)
+                                 : write_pfm(float_file, film);
+        if (!written) {
+            std::cerr << "Could not write " << float_file << std::endl;
+        }
+    }
+
+    auto heatmap_file = program.get<std::string>("--heatmap");
+    if (!heatmap_file.empty()) {
+        write_sample_heatmap(heatmap_file, film.sample_counts(), rs);
+    }
 
     std::cerr << "\nDone.\n";
     return 0;
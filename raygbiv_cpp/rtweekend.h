@@ -4,6 +4,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -33,16 +34,65 @@ degrees_to_radians(float degrees)
     return degrees * pi / 180.0f;
 }
 
-// static std::random_device rd;  //Will be used to obtain a seed for the random number engine
-// static std::mt19937 generator(rd()); //Standard mersenne_twister_engine seeded with rd()
+// PCG32 (XSH RR variant, see pcg-random.org): 64 bits of state, 32 random bits per call and much faster than the
+// standard engines. seed selects where the sequence starts and stream which of 2^63 sequences it follows.
+class pcg32
+{
+  public:
+    pcg32(uint64_t seed = 0x853c49e6748fea9bull, uint64_t stream = 0xda3e39cb94b95bdbull) { reseed(seed, stream); }
+
+    void reseed(uint64_t seed, uint64_t stream)
+    {
+        state = 0u;
+        inc = (stream << 1u) | 1u;
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    uint32_t next_uint()
+    {
+        uint64_t old = state;
+        state = old * 6364136223846793005ull + inc;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        auto rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    // uniform in [0,1), from the top 24 bits so that every value is exactly representable
+    float next_float() { return (next_uint() >> 8) * (1.0f / 16777216.0f); }
+
+  private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// Every thread draws from its own generator, so render threads never contend for one.
+inline pcg32&
+thread_rng()
+{
+    static thread_local pcg32 rng;
+    return rng;
+}
+
+// Restarts this thread's generator for one pixel sample. The numbers a sample uses then only depend on which
+// sample it is, not on which thread traces it or in what order, so renders can be reproduced.
+inline void
+seed_thread_rng(uint64_t pixel, uint64_t sample)
+{
+    // splitmix64 finalizer, so that neighbouring pixels and samples start far apart in the sequence
+    uint64_t z = (pixel << 32) ^ sample ^ 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z = z ^ (z >> 31);
+    thread_rng().reseed(z, pixel);
+}
 
 inline float
 random_float()
 {
-    // static std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
-    // return distribution(generator);
-
-    return rand() / (RAND_MAX + 1.0f);
+    // Returns a random real in [0,1).
+    return thread_rng().next_float();
 }
 
 inline float
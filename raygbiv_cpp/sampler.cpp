@@ -0,0 +1,280 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// a cheap 32 bit integer hash with good avalanche (Wellons' "lowbias32")
+uint32_t
+mix_bits(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+uint32_t
+hash_ints(uint32_t a, uint32_t b, uint32_t c)
+{
+    return mix_bits(a ^ mix_bits(b ^ mix_bits(c + 0x9e3779b9u)));
+}
+
+// the top 24 bits as a float in [0,1), like pcg32::next_float
+float
+to_unit_float(uint32_t x)
+{
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+uint32_t
+reverse_bits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// element i of a random permutation of [0, l) chosen by p, without building the permutation (Kensler, "Correlated
+// Multi-Jittered Sampling")
+uint32_t
+permutation_element(uint32_t i, uint32_t l, uint32_t p)
+{
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893du;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3fu;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3dfu;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+// Owen scrambling of the bits of x, most significant first, by a hash (Burley, "Practical Hash-based Owen
+// Scrambling"). Applied to a sequence index it shuffles the points without breaking up aligned power of two blocks.
+uint32_t
+nested_uniform_scramble(uint32_t x, uint32_t seed)
+{
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverse_bits(x);
+}
+
+// the first two dimensions of the Sobol sequence, which together form a (0,2)-sequence
+uint32_t
+sobol_dimension_0(uint32_t index)
+{
+    return reverse_bits(index);
+}
+
+uint32_t
+sobol_dimension_1(uint32_t index)
+{
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+float
+scrambled_sobol_1d(uint32_t index, uint32_t seed)
+{
+    index = nested_uniform_scramble(index, seed);
+    return to_unit_float(nested_uniform_scramble(sobol_dimension_0(index), mix_bits(seed + 1)));
+}
+
+vec2
+scrambled_sobol_2d(uint32_t index, uint32_t seed)
+{
+    index = nested_uniform_scramble(index, seed);
+    auto x = nested_uniform_scramble(sobol_dimension_0(index), mix_bits(seed + 1));
+    auto y = nested_uniform_scramble(sobol_dimension_1(index), mix_bits(seed + 2));
+    return vec2(to_unit_float(x), to_unit_float(y));
+}
+
+const int blue_noise_size = 64;
+
+// The order in which to visit the pixels of a 64x64 tile so that each next pixel is in the largest gap left by the
+// ones before it, as in the void-and-cluster method: every placed pixel adds a gaussian to the energy of the pixels
+// around it (wrapping around the tile edges), and the next one is the pixel with the least energy. Any run of
+// consecutive ranks is then spread over the tile as blue noise.
+const std::vector<uint32_t>&
+blue_noise_ranks()
+{
+    static const std::vector<uint32_t> ranks = [] {
+        const int n = blue_noise_size * blue_noise_size;
+        const int radius = 6;
+        const float sigma = 1.5f;
+
+        // a little noise to break the ties of the empty tile
+        std::vector<float> energy(n);
+        for (int p = 0; p < n; ++p)
+            energy[p] = 1e-4f * to_unit_float(hash_ints(p, 0, 0));
+
+        std::vector<uint32_t> rank(n);
+        for (int r = 0; r < n; ++r) {
+            int p = static_cast<int>(std::min_element(energy.begin(), energy.end()) - energy.begin());
+            rank[p] = r;
+            int px = p % blue_noise_size;
+            int py = p / blue_noise_size;
+            for (int dy = -radius; dy <= radius; ++dy) {
+                for (int dx = -radius; dx <= radius; ++dx) {
+                    int q = ((py + dy + blue_noise_size) % blue_noise_size) * blue_noise_size +
+                            (px + dx + blue_noise_size) % blue_noise_size;
+                    energy[q] += std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+                }
+            }
+            energy[p] = infinity;
+        }
+        return rank;
+    }();
+    return ranks;
+}
+
+} // namespace
+
+float
+independent_sampler::get_1d()
+{
+    ++dimension;
+    return random_float();
+}
+
+vec2
+independent_sampler::get_2d()
+{
+    dimension += 2;
+    auto x = random_float();
+    auto y = random_float();
+    return vec2(x, y);
+}
+
+stratified_sampler::stratified_sampler(int samples_per_pixel)
+  : n_samples(std::max(1, samples_per_pixel))
+{
+    x_strata = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(n_samples))));
+    y_strata = (n_samples + x_strata - 1) / x_strata;
+}
+
+float
+stratified_sampler::get_1d()
+{
+    auto stratum = permutation_element(index % n_samples, n_samples, hash_ints(pixel_x, pixel_y, dimension));
+    ++dimension;
+    return (stratum + random_float()) / n_samples;
+}
+
+vec2
+stratified_sampler::get_2d()
+{
+    // with more cells than samples each pixel leaves a different few of them empty
+    uint32_t cells = x_strata * y_strata;
+    auto cell = permutation_element(index % cells, cells, hash_ints(pixel_x, pixel_y, dimension));
+    dimension += 2;
+    auto x = (cell % x_strata + random_float()) / x_strata;
+    auto y = (cell / x_strata + random_float()) / y_strata;
+    return vec2(x, y);
+}
+
+float
+sobol_sampler::get_1d()
+{
+    auto seed = hash_ints(pixel_x, pixel_y, dimension);
+    ++dimension;
+    return scrambled_sobol_1d(index, seed);
+}
+
+vec2
+sobol_sampler::get_2d()
+{
+    auto seed = hash_ints(pixel_x, pixel_y, dimension);
+    dimension += 2;
+    return scrambled_sobol_2d(index, seed);
+}
+
+blue_noise_sampler::blue_noise_sampler(int samples_per_pixel)
+  : samples_per_rank(1)
+{
+    // the index of the last sample of the last rank has to fit in 32 bits
+    while (samples_per_rank < static_cast<uint32_t>(samples_per_pixel) && samples_per_rank < (1u << 20))
+        samples_per_rank <<= 1;
+    blue_noise_ranks();
+}
+
+uint32_t
+blue_noise_sampler::sequence_index() const
+{
+    const auto& ranks = blue_noise_ranks();
+    auto rank = ranks[(pixel_y & (blue_noise_size - 1)) * blue_noise_size + (pixel_x & (blue_noise_size - 1))];
+    return rank * samples_per_rank + static_cast<uint32_t>(index) % samples_per_rank;
+}
+
+uint32_t
+blue_noise_sampler::block_seed() const
+{
+    return hash_ints(pixel_x / blue_noise_size, pixel_y / blue_noise_size, dimension);
+}
+
+float
+blue_noise_sampler::get_1d()
+{
+    auto seed = block_seed();
+    ++dimension;
+    return scrambled_sobol_1d(sequence_index(), seed);
+}
+
+vec2
+blue_noise_sampler::get_2d()
+{
+    auto seed = block_seed();
+    dimension += 2;
+    return scrambled_sobol_2d(sequence_index(), seed);
+}
+
+std::unique_ptr<sampler>
+make_sampler(sampler_type type, int samples_per_pixel)
+{
+    switch (type) {
+        case sampler_type::independent:
+            return std::make_unique<independent_sampler>();
+        case sampler_type::stratified:
+            return std::make_unique<stratified_sampler>(samples_per_pixel);
+        case sampler_type::blue_noise:
+            return std::make_unique<blue_noise_sampler>(samples_per_pixel);
+        case sampler_type::sobol:
+        default:
+            return std::make_unique<sobol_sampler>();
+    }
+}
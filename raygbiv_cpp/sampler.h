@@ -0,0 +1,119 @@
+#pragma once
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+#include <memory>
+
+enum class sampler_type
+{
+    // a fresh random number for every dimension
+    independent,
+    // jittered strata, shuffled separately for each pixel and dimension
+    stratified,
+    // a (0,2)-sequence for each pair of dimensions, Owen scrambled separately for each pixel and dimension
+    sobol,
+    // the same sequences, scrambled per 64x64 block of pixels and split among the pixels by a blue noise ranking, so
+    // that the error left in neighbouring pixels differs as much as possible
+    blue_noise
+};
+
+// Hands out the numbers a path sample is built from. Every pixel sample starts over at dimension 0 and then takes the
+// dimensions in the same order: the pixel position, the lens, the shutter time and then, per bounce, the choice between
+// lights and material, the direction, for the wavefront integrator a point on a light and, once Russian roulette may
+// end the path, whether it goes on. Each of those asks for the dimension it needs in turn, so the same dimension always
+// drives the same decision, which is what lets the samples of a pixel spread out evenly in it. The materials' own
+// random choices, such as the fuzz of metal or reflecting rather than refracting in glass, and the scattering distance
+// in media still use the thread's rng.
+class sampler
+{
+  public:
+    virtual ~sampler() {}
+
+    // moves to sample sample_index of pixel (px, py), at dimension 0
+    void start_pixel_sample(int px, int py, int sample_index)
+    {
+        pixel_x = px;
+        pixel_y = py;
+        index = sample_index;
+        dimension = 0;
+    }
+
+    // the dimension the next get_1d or get_2d starts at
+    int next_dimension() const { return dimension; }
+
+    // moves back to sample sample_index of pixel (px, py) at dimension d, to go on with a sample that was set aside
+    // while others were taken
+    void resume_pixel_sample(int px, int py, int sample_index, int d)
+    {
+        start_pixel_sample(px, py, sample_index);
+        dimension = d;
+    }
+
+    // the next dimension, in [0,1)
+    virtual float get_1d() = 0;
+
+    // the next two dimensions, as a point of the unit square
+    virtual vec2 get_2d() = 0;
+
+  protected:
+    int pixel_x = 0;
+    int pixel_y = 0;
+    int index = 0;
+    int dimension = 0;
+};
+
+class independent_sampler : public sampler
+{
+  public:
+    virtual float get_1d() override;
+    virtual vec2 get_2d() override;
+};
+
+class stratified_sampler : public sampler
+{
+  public:
+    stratified_sampler(int samples_per_pixel);
+
+    virtual float get_1d() override;
+    virtual vec2 get_2d() override;
+
+  private:
+    int n_samples;
+    // the 2d strata form an x_strata by y_strata grid with at least n_samples cells
+    int x_strata;
+    int y_strata;
+};
+
+class sobol_sampler : public sampler
+{
+  public:
+    virtual float get_1d() override;
+    virtual vec2 get_2d() override;
+};
+
+class blue_noise_sampler : public sampler
+{
+  public:
+    blue_noise_sampler(int samples_per_pixel);
+
+    virtual float get_1d() override;
+    virtual vec2 get_2d() override;
+
+  private:
+    // where this pixel sample is in the sequences shared by its block of pixels
+    uint32_t sequence_index() const;
+    uint32_t block_seed() const;
+
+    // samples_per_pixel rounded up to a power of two, so every pixel's share of a sequence is a whole (0,m,2)-net
+    uint32_t samples_per_rank;
+};
+
+// a sampler of the given type for pixels taking up to samples_per_pixel samples
+std::unique_ptr<sampler>
+make_sampler(sampler_type type, int samples_per_pixel);
+
+#endif
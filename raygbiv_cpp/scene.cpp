@@ -1,429 +1,716 @@
 #include "scene.h"
 
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
 #include "aarect.h"
 #include "box.h"
-#include "bvh_node.h"
-#include "camera.h"
 #include "constant_medium.h"
-#include "material.h"
+#include "mesh_cache.h"
 #include "moving_sphere.h"
 #include "sphere.h"
+#include "text_parse.h"
 #include "texture.h"
+#include "tlas.h"
+#include "transform.h"
+#include "triangle_mesh.h"
 
-hittable_list
-two_spheres()
-{
-    hittable_list objects;
-
-    auto checker = make_shared<checker_texture>(color(0.2f, 0.3f, 0.1f), color(0.9f, 0.9f, 0.9f));
+namespace {
 
-    objects.add(make_shared<sphere>(point3(0.0f, -10.0f, 0.0f), 10.0f, make_shared<lambertian>(checker)));
-    objects.add(make_shared<sphere>(point3(0.0f, 10.0f, 0.0f), 10.0f, make_shared<lambertian>(checker)));
+// in the order of their numbers
+const char* const builtin_scenes[] = { "random_spheres", "two_spheres", "two_perlin_spheres", "earth",
+                                       "simple_light",   "cornell_box", "cornell_smoke",      "veach_mis",
+                                       "final_scene",    "cornell_mesh" };
 
-    return objects;
-}
-
-hittable_list
-random_scene()
+// what went wrong and on which line; load_scene says so, in front of the name of the file
+struct scene_error
 {
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(color(0.2f, 0.3f, 0.1f), color(0.9f, 0.9f, 0.9f));
-    world.add(make_shared<sphere>(point3(0.0f, -1000.0f, 0.0f), 1000.0f, make_shared<lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_float();
-            point3 center(a + 0.9f * random_float(), 0.2f, b + 0.9f * random_float());
-
-            if ((center - point3(4, 0.2f, 0)).length() > 0.9f) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = glm::linearRand(vec3(0), vec3(1)) * glm::linearRand(vec3(0), vec3(1));
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0.0f, random_float(0.0f, 0.5f), 0.0f);
-                    world.add(make_shared<moving_sphere>(center, center2, 0.0f, 1.0f, 0.2f, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = glm::linearRand(vec3(0.5), vec3(1.0)); //::random(0.5, 1);
-                    auto fuzz = random_float(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2f, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5f);
-                    world.add(make_shared<sphere>(center, 0.2f, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5f);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0f, material1));
+    int line;
+    std::string what;
+};
 
-    auto material2 = make_shared<lambertian>(color(0.4f, 0.2f, 0.1f));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0f, material2));
+struct texture_ref
+{
+    shared_ptr<texture> ptr;
+    // in scene_parser::textures, to tell textures apart in the keys of the materials made from them
+    uint32_t index;
+};
 
-    auto material3 = make_shared<metal>(color(0.7f, 0.6f, 0.5f), 0.0f);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0f, material3));
+// a step of a transform, kept until the object it moves has been read, since fit needs the object's box
+struct transform_step
+{
+    enum kind_type
+    {
+        translate,
+        scale,
+        rotate_x,
+        rotate_y,
+        rotate_z,
+        fit
+    } kind;
+    vec3 values;
+};
 
-    return world;
+void
+append_key(std::string& key, float value)
+{
+    char bytes[sizeof(float)];
+    std::memcpy(bytes, &value, sizeof(float));
+    key.append(bytes, sizeof(float));
 }
 
-hittable_list
-two_perlin_spheres()
+void
+append_key(std::string& key, const vec3& value)
 {
-    hittable_list objects;
-
-    auto pertext = make_shared<noise_texture>(4.0f);
-    objects.add(make_shared<sphere>(point3(0.0f, -1000.0f, 0.0f), 1000.0f, make_shared<lambertian>(pertext)));
-    objects.add(make_shared<sphere>(point3(0.0f, 2.0f, 0.0f), 2.0f, make_shared<lambertian>(pertext)));
+    append_key(key, value.x);
+    append_key(key, value.y);
+    append_key(key, value.z);
+}
 
-    return objects;
+void
+append_key(std::string& key, uint32_t value)
+{
+    char bytes[sizeof(uint32_t)];
+    std::memcpy(bytes, &value, sizeof(uint32_t));
+    key.append(bytes, sizeof(uint32_t));
 }
 
-hittable_list
-earth()
+bool
+is_space(char c)
 {
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0, 0, 0), 2.0f, earth_surface);
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
 
-    return hittable_list(globe);
+// where a word or a number has to end
+bool
+is_delimiter(char c)
+{
+    return is_space(c) || c == 0 || c == '{' || c == '}' || c == '#' || c == '"';
 }
 
-hittable_list
-simple_light()
+// Reads a scene in one pass over its text, which has to end in a zero, making each object as soon as it has been
+// read. A recursive descent parser, with a function for each kind of thing in the grammar in scene.h.
+class scene_parser
 {
-    hittable_list objects;
+  public:
+    scene_parser(const std::string& filename,
+                 const char* text,
+                 render_settings& rs,
+                 hittable_list& world,
+                 hittable_list& lights,
+                 material_table& materials,
+                 color& background)
+      : p(text)
+      , rs(rs)
+      , world(world)
+      , lights(lights)
+      , materials(materials)
+      , background(background)
+    {
+        auto slash = filename.find_last_of("/\\");
+        if (slash != std::string::npos)
+            directory = filename.substr(0, slash + 1);
+    }
 
-    auto pertext = make_shared<noise_texture>(4.0f);
-    objects.add(make_shared<sphere>(point3(0.0f, -1000.0f, 0.0f), 1000.0f, make_shared<lambertian>(pertext)));
-    objects.add(make_shared<sphere>(point3(0.0f, 2.0f, 0.0f), 2.0f, make_shared<lambertian>(pertext)));
+    void parse()
+    {
+        for (skip_space(); *p != 0; skip_space()) {
+            const char* start = p;
+            auto statement = word();
+            if (statement == "render") {
+                parse_render();
+            } else if (statement == "camera") {
+                parse_camera();
+            } else if (statement == "texture") {
+                auto name = std::string(word());
+                auto t = parse_texture();
+                if (!texture_names.emplace(name, t).second)
+                    fail("texture '" + name + "' is already defined");
+            } else if (statement == "material") {
+                auto name = std::string(word());
+                auto m = parse_material();
+                if (!material_names.emplace(name, m).second)
+                    fail("material '" + name + "' is already defined");
+            } else if (statement == "define") {
+                auto name = std::string(word());
+                auto object = parse_object();
+                if (!object_names.emplace(name, object).second)
+                    fail("object '" + name + "' is already defined");
+            } else if (statement == "instance") {
+                parse_instance();
+            } else if (statement == "light") {
+                in_light = true;
+                lights.add(parse_object());
+                in_light = false;
+            } else {
+                p = start;
+                world.add(parse_object());
+            }
+        }
 
-    auto difflight = make_shared<diffuse_light>(color(4, 4, 4));
-    objects.add(make_shared<xy_rect>(3.0f, 5.0f, 1.0f, 3.0f, -2.0f, difflight));
+        if (instances) {
+            instances->build(rs.bvh);
+            world.add(instances);
+        }
+    }
 
-    objects.add(make_shared<sphere>(point3(0.0f, 7.0f, 0.0f), 2.0f, difflight));
+    camera make_camera() const
+    {
+        return camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus_dist, time0, time1);
+    }
 
-    return objects;
-}
+  public:
+    float aspect_ratio = 16.0f / 9.0f;
+    int primitives = 0;
+    // definitions that were already made, and so were shared instead of made again
+    int shared_textures = 0;
+    int shared_materials = 0;
+    std::vector<texture_ref> textures;
+
+  private:
+    [[noreturn]] void fail(const std::string& what) const { throw scene_error{ line, what }; }
+
+    void skip_space()
+    {
+        for (;;) {
+            if (*p == '\n') {
+                ++line;
+                ++p;
+            } else if (is_space(*p)) {
+                ++p;
+            } else if (*p == '#') {
+                while (*p != '\n' && *p != 0)
+                    ++p;
+            } else {
+                return;
+            }
+        }
+    }
 
-hittable_list
-cornell_box()
-{
-    hittable_list objects;
-
-    auto red = make_shared<lambertian>(color(.65f, .05f, .05f));
-    auto white = make_shared<lambertian>(color(.73f, .73f, .73f));
-    auto green = make_shared<lambertian>(color(.12f, .45f, .15f));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    objects.add(make_shared<yz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, green));
-    objects.add(make_shared<yz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 0.0f, red));
-    objects.add(make_shared<flip_face>(make_shared<xz_rect>(213.0f, 343.0f, 227.0f, 332.0f, 554.0f, light)));
-    objects.add(make_shared<xz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, white));
-    objects.add(make_shared<xz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 0.0f, white));
-    objects.add(make_shared<xy_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, white));
-
-    shared_ptr<material> aluminum = make_shared<metal>(color(0.8f, 0.85f, 0.88f), 0.0f);
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), aluminum);
-    box1 = make_shared<rotate_y>(box1, 15.0f);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
-    objects.add(box1);
-
-    auto glass = make_shared<dielectric>(1.5f);
-    objects.add(make_shared<sphere>(point3(190, 90, 190), 90.0f, glass));
-
-    // shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-    // box2 = make_shared<rotate_y>(box2, -18.0f);
-    // box2 = make_shared<translate>(box2, vec3(130, 0, 65));
-    // objects.add(box2);
-
-    return objects;
-}
-#if 0
-hittable_list cornell_box() {
-    hittable_list objects;
-
-    auto red = make_shared<lambertian>(color(.65f, .05f, .05f));
-    auto white = make_shared<lambertian>(color(.73f, .73f, .73f));
-    auto green = make_shared<lambertian>(color(.12f, .45f, .15f));
-    auto light = make_shared<diffuse_light>(color(15.0f, 15.0f, 15.0f));
-
-    objects.add(make_shared<yz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, green));
-    objects.add(make_shared<yz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 0.0f, red));
-    objects.add(make_shared<xz_rect>(213.0f, 343.0f, 227.0f, 332.0f, 554.0f, light));
-    objects.add(make_shared<xz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 0.0f, white));
-    objects.add(make_shared<xz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, white));
-    objects.add(make_shared<xy_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, white));
-
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0.0f, 0.0f, 0.0f), point3(165.0f, 330.0f, 165.0f), white);
-    box1 = make_shared<rotate_y>(box1, 15.0f);
-    box1 = make_shared<translate>(box1, vec3(265.0f, 0.0f, 295.0f));
-    objects.add(box1);
-
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0.0f, 0.0f, 0.0f), point3(165.0f, 165.0f, 165.0f), white);
-    box2 = make_shared<rotate_y>(box2, -18.0f);
-    box2 = make_shared<translate>(box2, vec3(130.0f, 0.0f, 65.0f));
-    objects.add(box2);
-
-    return objects;
-}
-#endif
-hittable_list
-cornell_smoke()
-{
-    hittable_list objects;
+    std::string_view word()
+    {
+        skip_space();
+        const char* start = p;
+        while (!is_delimiter(*p))
+            ++p;
+        if (p == start)
+            fail(*p == 0 ? "unexpected end of file" : std::string("expected a word before '") + *p + "'");
+        return std::string_view(start, p - start);
+    }
 
-    auto red = make_shared<lambertian>(color(.65f, .05f, .05f));
-    auto white = make_shared<lambertian>(color(.73f, .73f, .73f));
-    auto green = make_shared<lambertian>(color(.12f, .45f, .15f));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
+    // the next word, which is left to be read again
+    std::string_view peek_word()
+    {
+        skip_space();
+        const char* end = p;
+        while (!is_delimiter(*end))
+            ++end;
+        return std::string_view(p, end - p);
+    }
 
-    objects.add(make_shared<yz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, green));
-    objects.add(make_shared<yz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 0.0f, red));
-    objects.add(make_shared<xz_rect>(113.0f, 443.0f, 127.0f, 432.0f, 554.0f, light));
-    objects.add(make_shared<xz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, white));
-    objects.add(make_shared<xz_rect>(0.0f, 555.0f, 0.0f, 555.0f, 0.0f, white));
-    objects.add(make_shared<xy_rect>(0.0f, 555.0f, 0.0f, 555.0f, 555.0f, white));
+    bool next_is_number()
+    {
+        skip_space();
+        return is_digit(*p) || *p == '-' || *p == '+' || *p == '.';
+    }
 
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0, 0, 0), point3(165, 330, 165), white);
-    box1 = make_shared<rotate_y>(box1, 15.0f);
-    box1 = make_shared<translate>(box1, vec3(265, 0, 295));
+    bool next_is(char c)
+    {
+        skip_space();
+        return *p == c;
+    }
 
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0, 0, 0), point3(165, 165, 165), white);
-    box2 = make_shared<rotate_y>(box2, -18.0f);
-    box2 = make_shared<translate>(box2, vec3(130, 0, 65));
+    void expect(char c)
+    {
+        if (!next_is(c))
+            fail(std::string("expected '") + c + "'");
+        ++p;
+    }
 
-    objects.add(make_shared<constant_medium>(box1, 0.01f, color(0, 0, 0)));
-    objects.add(make_shared<constant_medium>(box2, 0.01f, color(1, 1, 1)));
+    float number()
+    {
+        skip_space();
+        float value;
+        const char* end = parse_float(p, value);
+        if (end == nullptr || !is_delimiter(*end))
+            fail("expected a number, not '" + std::string(peek_word()) + "'");
+        p = end;
+        return value;
+    }
 
-    return objects;
-}
+    vec3 vector()
+    {
+        float x = number();
+        float y = number();
+        float z = number();
+        return vec3(x, y, z);
+    }
 
-void
-veach_mis(hittable_list& world, shared_ptr<hittable_list>& lights)
-{
-    auto mat1 = make_shared<lambertian>(color(1.0f, 0.0f, 0.0f));
-
-    auto light1 = make_shared<sphere>(point3(-1.5, 3, -1), 0.03f, make_shared<diffuse_light>(color(15, 15, 15)));
-    auto light2 = make_shared<sphere>(point3(-0.5, 3, -1), 0.1f, make_shared<diffuse_light>(color(15, 15, 15)));
-    auto light3 = make_shared<sphere>(point3(0.5, 3, -1), 0.3f, make_shared<diffuse_light>(color(15, 15, 15)));
-    auto light4 = make_shared<sphere>(point3(1.5, 3, -1), 0.5f, make_shared<diffuse_light>(color(15, 15, 15)));
-    world.add(light1);
-    world.add(light2);
-    world.add(light3);
-    world.add(light4);
-    lights->add(light1);
-    lights->add(light2);
-    lights->add(light3);
-    lights->add(light4);
-
-    world.add(make_shared<translate>(
-      make_shared<rotate_x>(make_shared<xy_rect>(-2.0f, 2.0f, -0.5f, 0.5f, 0.0f, mat1), 0.0f), vec3(0.0, 0.0, 0.0)));
-    world.add(
-      make_shared<translate>(make_shared<rotate_x>(make_shared<xy_rect>(-2.0f, 2.0f, -0.5f, 0.5f, 0.0f, mat1), -15.0f),
-                             vec3(0.0, -1.0, -0.2)));
-    world.add(
-      make_shared<translate>(make_shared<rotate_x>(make_shared<xy_rect>(-2.0f, 2.0f, -0.5f, 0.5f, 0.0f, mat1), -30.0f),
-                             vec3(0.0, -2.0, -0.6)));
-    world.add(
-      make_shared<translate>(make_shared<rotate_x>(make_shared<xy_rect>(-2.0f, 2.0f, -0.5f, 0.5f, 0.0f, mat1), -45.0f),
-                             vec3(0.0, -3.0, -1.2)));
-
-    //    objects.add(make_shared<translate>(
-    //      make_shared<rotate_y>(
-    //        make_shared<flip_face>(
-    //          make_shared<xz_rect>(-2.0f, 2.0f, -0.5f, 0.5f, 0.0f, mat1)), 45.0f), vec3(0.0, 0.0, 0.0)));
-
-    // objects.add(make_shared<translate>(
-    // make_shared<rotate_y>(make_shared<sphere>(point3(0,0,0), 1.0f, mat1), 45.0f), vec3(0.0, 0.0, 0.0)));
-}
+    int integer()
+    {
+        skip_space();
+        long long value;
+        const char* end = parse_int(p, value);
+        if (end == nullptr || !is_delimiter(*end))
+            fail("expected a whole number, not '" + std::string(peek_word()) + "'");
+        p = end;
+        return static_cast<int>(value);
+    }
 
-hittable_list
-final_scene()
-{
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48f, 0.83f, 0.53f));
-
-    const int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++) {
-        for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0f;
-            auto x0 = -1000.0f + i * w;
-            auto z0 = -1000.0f + j * w;
-            auto y0 = 0.0f;
-            auto x1 = x0 + w;
-            auto y1 = random_float(1.0f, 101.0f);
-            auto z1 = z0 + w;
-
-            boxes1.add(make_shared<box>(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+    // a file name, resolved against the directory of the scene if the file is there
+    std::string path()
+    {
+        skip_space();
+        if (*p != '"')
+            fail("expected a file name in double quotes");
+        const char* start = ++p;
+        while (*p != '"' && *p != '\n' && *p != 0)
+            ++p;
+        if (*p != '"')
+            fail("file name without its closing quote");
+        std::string name(start, p++);
+
+        bool relative = !name.empty() && name[0] != '/' && name[0] != '\\' && (name.size() < 2 || name[1] != ':');
+        if (relative && !directory.empty() && std::ifstream(directory + name))
+            return directory + name;
+        return name;
+    }
+
+    void parse_render()
+    {
+        expect('{');
+        while (!next_is('}')) {
+            auto setting = word();
+            if (setting == "width") {
+                rs.image_width = integer();
+            } else if (setting == "aspect") {
+                aspect_ratio = number();
+                if (next_is_number())
+                    aspect_ratio /= number();
+            } else if (setting == "samples") {
+                rs.samples_per_pixel = integer();
+            } else if (setting == "max_depth") {
+                rs.max_path_size = integer();
+            } else if (setting == "background") {
+                background = vector();
+            } else {
+                fail("unknown render setting '" + std::string(setting) + "'");
+            }
         }
+        ++p;
+        if (rs.image_width < 1 || aspect_ratio <= 0.0f || rs.samples_per_pixel < 1 || rs.max_path_size < 1)
+            fail("the width, aspect, samples and max_depth have to be positive");
     }
 
-    hittable_list objects;
+    void parse_camera()
+    {
+        expect('{');
+        while (!next_is('}')) {
+            auto setting = word();
+            if (setting == "lookfrom") {
+                lookfrom = vector();
+            } else if (setting == "lookat") {
+                lookat = vector();
+            } else if (setting == "vup") {
+                vup = vector();
+            } else if (setting == "vfov") {
+                vfov = number();
+            } else if (setting == "aperture") {
+                aperture = number();
+            } else if (setting == "focus_dist") {
+                focus_dist = number();
+            } else if (setting == "time") {
+                time0 = number();
+                time1 = number();
+            } else {
+                fail("unknown camera setting '" + std::string(setting) + "'");
+            }
+        }
+        ++p;
+    }
 
-    objects.add(make_shared<bvh_node>(boxes1, 0.0f, 1.0f));
+    // the texture made from key before, or else the one make() returns
+    template<class F>
+    texture_ref shared_texture(std::string&& key, F make)
+    {
+        auto found = texture_keys.find(key);
+        if (found != texture_keys.end()) {
+            ++shared_textures;
+            return textures[found->second];
+        }
+        auto index = static_cast<uint32_t>(textures.size());
+        textures.push_back({ make(), index });
+        texture_keys.emplace(std::move(key), index);
+        return textures.back();
+    }
 
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    objects.add(make_shared<xz_rect>(123.0f, 423.0f, 147.0f, 412.0f, 554.0f, light));
+    texture_ref solid_texture(const color& c)
+    {
+        std::string key = "s";
+        append_key(key, c);
+        return shared_texture(std::move(key), [&] { return make_shared<solid_color>(c); });
+    }
 
-    auto center1 = point3(400, 400, 200);
-    auto center2 = center1 + vec3(30, 0, 0);
-    auto moving_sphere_material = make_shared<lambertian>(color(0.7f, 0.3f, 0.1f));
-    objects.add(make_shared<moving_sphere>(center1, center2, 0.0f, 1.0f, 50.0f, moving_sphere_material));
+    texture_ref parse_texture()
+    {
+        if (next_is_number())
+            return solid_texture(vector());
+
+        auto kind = word();
+        if (kind == "solid")
+            return solid_texture(vector());
+        if (kind == "checker") {
+            auto even = parse_texture();
+            auto odd = parse_texture();
+            std::string key = "c";
+            append_key(key, even.index);
+            append_key(key, odd.index);
+            return shared_texture(std::move(key), [&] { return make_shared<checker_texture>(even.ptr, odd.ptr); });
+        }
+        if (kind == "noise") {
+            float scale = number();
+            std::string key = "n";
+            append_key(key, scale);
+            return shared_texture(std::move(key), [&] { return make_shared<noise_texture>(scale); });
+        }
+        if (kind == "image") {
+            auto file = path();
+            return shared_texture("i" + file, [&] { return make_shared<image_texture>(file.c_str()); });
+        }
 
-    objects.add(make_shared<sphere>(point3(260, 150, 45), 50.0f, make_shared<dielectric>(1.5f)));
-    objects.add(make_shared<sphere>(point3(0, 150, 145), 50.0f, make_shared<metal>(color(0.8f, 0.8f, 0.9f), 1.0f)));
+        auto named = texture_names.find(std::string(kind));
+        if (named == texture_names.end())
+            fail("unknown texture '" + std::string(kind) + "'");
+        return named->second;
+    }
 
-    auto boundary = make_shared<sphere>(point3(360, 150, 145), 70.0f, make_shared<dielectric>(1.5f));
-    objects.add(boundary);
-    objects.add(make_shared<constant_medium>(boundary, 0.2f, color(0.2f, 0.4f, 0.9f)));
-    boundary = make_shared<sphere>(point3(0, 0, 0), 5000.0f, make_shared<dielectric>(1.5f));
-    objects.add(make_shared<constant_medium>(boundary, .0001f, color(1, 1, 1)));
+    // the material made from key before, or else the one make() returns, added to the table
+    template<class F>
+    uint32_t shared_material(std::string&& key, F make)
+    {
+        auto found = material_keys.find(key);
+        if (found != material_keys.end()) {
+            ++shared_materials;
+            return found->second;
+        }
+        auto id = materials.add(make());
+        material_keys.emplace(std::move(key), id);
+        return id;
+    }
 
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    objects.add(make_shared<sphere>(point3(400, 200, 400), 100.0f, emat));
-    auto pertext = make_shared<noise_texture>(0.1f);
-    objects.add(make_shared<sphere>(point3(220, 280, 300), 80.0f, make_shared<lambertian>(pertext)));
+    uint32_t parse_material()
+    {
+        // a light's shape is only sampled, never shaded
+        if (in_light)
+            return no_material;
+
+        auto kind = word();
+        if (kind == "lambertian" || kind == "diffuse_light" || kind == "isotropic") {
+            auto albedo = parse_texture();
+            std::string key(1, kind[0]);
+            append_key(key, albedo.index);
+            return shared_material(std::move(key), [&]() -> shared_ptr<material> {
+                if (kind == "lambertian")
+                    return make_shared<lambertian>(albedo.ptr);
+                if (kind == "diffuse_light")
+                    return make_shared<diffuse_light>(albedo.ptr);
+                return make_shared<isotropic>(albedo.ptr);
+            });
+        }
+        if (kind == "metal") {
+            auto albedo = vector();
+            float fuzz = number();
+            std::string key = "m";
+            append_key(key, albedo);
+            append_key(key, fuzz);
+            return shared_material(std::move(key), [&] { return make_shared<metal>(albedo, fuzz); });
+        }
+        if (kind == "dielectric") {
+            float index_of_refraction = number();
+            std::string key = "g";
+            append_key(key, index_of_refraction);
+            return shared_material(std::move(key), [&] { return make_shared<dielectric>(index_of_refraction); });
+        }
 
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73f, .73f, .73f));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(glm::linearRand(vec3(0), vec3(165)), 10.0f, white));
+        auto named = material_names.find(std::string(kind));
+        if (named == material_names.end())
+            fail("unknown material '" + std::string(kind) + "'");
+        return named->second;
     }
 
-    objects.add(make_shared<translate>(make_shared<rotate_y>(make_shared<bvh_node>(boxes2, 0.0f, 1.0f), 15.0f),
-                                       vec3(-100, 270, 395)));
+    shared_ptr<hittable> parse_object()
+    {
+        auto kind = word();
+        if (kind == "sphere") {
+            auto center = vector();
+            float radius = number();
+            auto mat = parse_material();
+            ++primitives;
+            return make_shared<sphere>(center, radius, mat);
+        }
+        if (kind == "moving_sphere") {
+            auto center0 = vector();
+            auto center1 = vector();
+            float t0 = number();
+            float t1 = number();
+            float radius = number();
+            auto mat = parse_material();
+            ++primitives;
+            return make_shared<moving_sphere>(center0, center1, t0, t1, radius, mat);
+        }
+        if (kind == "xy_rect" || kind == "xz_rect" || kind == "yz_rect") {
+            float a0 = number();
+            float a1 = number();
+            float b0 = number();
+            float b1 = number();
+            float k = number();
+            auto mat = parse_material();
+            ++primitives;
+            if (kind == "xy_rect")
+                return make_shared<xy_rect>(a0, a1, b0, b1, k, mat);
+            if (kind == "xz_rect")
+                return make_shared<xz_rect>(a0, a1, b0, b1, k, mat);
+            return make_shared<yz_rect>(a0, a1, b0, b1, k, mat);
+        }
+        if (kind == "box") {
+            auto p0 = vector();
+            auto p1 = vector();
+            auto mat = parse_material();
+            ++primitives;
+            return make_shared<box>(p0, p1, mat);
+        }
+        if (kind == "mesh") {
+            auto file = path();
+            auto mat = parse_material();
+            auto mesh = load_mesh_cached(file, mat, rs.bvh);
+            if (!mesh)
+                fail("cannot load mesh '" + file + "'");
+            primitives += static_cast<int>(mesh->geometry.triangle_count());
+            return mesh;
+        }
+        if (kind == "flip_face")
+            return make_shared<flip_face>(parse_object());
+        if (kind == "transform") {
+            auto steps = parse_steps();
+            if (steps.empty())
+                fail("transform without any steps");
+            auto object = parse_object();
+            return make_shared<transform_instance>(object, compose(steps, *object));
+        }
+        if (kind == "medium") {
+            float density = number();
+            auto albedo = parse_texture();
+            auto boundary = parse_object();
+            return make_shared<constant_medium>(boundary, density, albedo.ptr, materials);
+        }
+        if (kind == "group" || kind == "bvh") {
+            auto list = make_shared<hittable_list>();
+            expect('{');
+            while (!next_is('}'))
+                list->add(parse_object());
+            ++p;
+            if (kind == "group")
+                return list;
+            if (list->size() == 0)
+                fail("bvh without any objects");
+            return make_shared<bvh_node>(*list, 0.0f, 1.0f, rs.bvh);
+        }
 
-    return objects;
+        auto named = object_names.find(std::string(kind));
+        if (named == object_names.end())
+            fail("unknown object '" + std::string(kind) + "'");
+        return named->second;
+    }
 
-    // hittable_list worldbvh;
-    // worldbvh.add(make_shared<bvh_node>(objects, 0.0f, 1.0f));
+    std::vector<transform_step> parse_steps()
+    {
+        std::vector<transform_step> steps;
+        for (;;) {
+            auto kind = peek_word();
+            if (kind == "translate") {
+                word();
+                steps.push_back({ transform_step::translate, vector() });
+            } else if (kind == "scale") {
+                word();
+                float x = number();
+                if (next_is_number()) {
+                    float y = number();
+                    float z = number();
+                    steps.push_back({ transform_step::scale, vec3(x, y, z) });
+                } else {
+                    steps.push_back({ transform_step::scale, vec3(x, x, x) });
+                }
+            } else if (kind == "rotate_x" || kind == "rotate_y" || kind == "rotate_z") {
+                word();
+                auto axis = transform_step::rotate_z;
+                if (kind == "rotate_x")
+                    axis = transform_step::rotate_x;
+                else if (kind == "rotate_y")
+                    axis = transform_step::rotate_y;
+                steps.push_back({ axis, vec3(number(), 0.0f, 0.0f) });
+            } else if (kind == "fit") {
+                word();
+                steps.push_back({ transform_step::fit, vec3(number(), 0.0f, 0.0f) });
+            } else {
+                return steps;
+            }
+        }
+    }
 
-    // return worldbvh;
-}
+    affine_transform compose(const std::vector<transform_step>& steps, const hittable& object) const
+    {
+        affine_transform m;
+        for (size_t i = 0; i < steps.size(); i++) {
+            const auto& step = steps[i];
+            switch (step.kind) {
+                case transform_step::translate:
+                    m = m * affine_transform::translation(step.values);
+                    break;
+                case transform_step::scale:
+                    m = m * affine_transform::scaling(step.values);
+                    break;
+                case transform_step::rotate_x:
+                    m = m * affine_transform::rotation_x(step.values.x);
+                    break;
+                case transform_step::rotate_y:
+                    m = m * affine_transform::rotation_y(step.values.x);
+                    break;
+                case transform_step::rotate_z:
+                    m = m * affine_transform::rotation_z(step.values.x);
+                    break;
+                case transform_step::fit: {
+                    aabb bounds;
+                    if (i + 1 != steps.size())
+                        fail("fit has to be the last step");
+                    if (!object.bounding_box(time0, time1, bounds))
+                        fail("fit needs an object with a box");
+                    vec3 extent = bounds.max() - bounds.min();
+                    float longest = std::fmax(extent.x, std::fmax(extent.y, extent.z));
+                    if (!(longest > 0.0f))
+                        fail("fit needs an object with a size");
+                    float scale = step.values.x / longest;
+                    point3 base(0.5f * (bounds.min().x + bounds.max().x),
+                                bounds.min().y,
+                                0.5f * (bounds.min().z + bounds.max().z));
+                    m = m * affine_transform::scaling(vec3(scale, scale, scale)) *
+                        affine_transform::translation(-base);
+                } break;
+            }
+        }
+        return m;
+    }
 
-void
-load_scene(int scenetype,
+    void parse_instance()
+    {
+        auto name = std::string(word());
+        auto named = object_names.find(name);
+        if (named == object_names.end())
+            fail("unknown object '" + name + "'");
+        auto steps = parse_steps();
+
+        if (!instances)
+            instances = make_shared<tlas>();
+        auto blas = blases.find(named->second.get());
+        if (blas == blases.end())
+            blas = blases.emplace(named->second.get(), instances->add_blas(named->second)).first;
+        instances->add_instance(blas->second, compose(steps, *named->second));
+    }
+
+  private:
+    const char* p;
+    int line = 1;
+    std::string directory;
+
+    render_settings& rs;
+    hittable_list& world;
+    hittable_list& lights;
+    material_table& materials;
+    color& background;
+
+    point3 lookfrom = point3(0.0f, 0.0f, -1.0f);
+    point3 lookat = point3(0.0f, 0.0f, 0.0f);
+    vec3 vup = vec3(0.0f, 1.0f, 0.0f);
+    float vfov = 40.0f;
+    float aperture = 0.0f;
+    float focus_dist = 10.0f;
+    float time0 = 0.0f;
+    float time1 = 1.0f;
+
+    // while reading the shape of a light
+    bool in_light = false;
+
+    std::unordered_map<std::string, texture_ref> texture_names;
+    std::unordered_map<std::string, uint32_t> material_names;
+    std::unordered_map<std::string, shared_ptr<hittable>> object_names;
+    // what each texture and material was made from: its kind, numbers and the indices of its textures, as bytes
+    std::unordered_map<std::string, uint32_t> texture_keys;
+    std::unordered_map<std::string, uint32_t> material_keys;
+
+    shared_ptr<tlas> instances;
+    // the index in instances of each object placed there
+    std::unordered_map<const hittable*, uint32_t> blases;
+};
+
+} // namespace
+
+bool
+load_scene(const std::string& filename,
            render_settings& rs,
            hittable_list& world,
            shared_ptr<hittable_list>& lights,
+           material_table& materials,
            camera& cam,
-           color& background)
+           color& background,
+           uint64_t& scene_hash)
 {
-    auto aspect_ratio = 16.0f / 9.0f;
-
-    point3 lookfrom;
-    point3 lookat;
-    auto vfov = 40.0f;
-    auto aperture = 0.0f;
-    auto dist_to_focus = 10.0f;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<char> text;
+    if (!read_file(filename, text)) {
+        std::cerr << "Cannot read scene " << filename << std::endl;
+        return false;
+    }
+    scene_hash = content_hash(text.data(), text.size() - 1);
 
     rs.image_width = 400;
     rs.samples_per_pixel = 100;
     rs.max_path_size = 50;
-    switch (scenetype) {
-        case 1:
-            world = random_scene();
-            lookfrom = point3(13.0f, 2.0f, 3.0f);
-            lookat = point3(0.0f, 0.0f, 0.0f);
-            vfov = 20.0f;
-            aperture = 0.1f;
-            background = color(0.70f, 0.80f, 1.00f);
-            break;
-
-        case 2:
-            world = two_spheres();
-            lookfrom = point3(13.0f, 2.0f, 3.0f);
-            lookat = point3(0.0f, 0.0f, 0.0f);
-            vfov = 20.0f;
-            background = color(0.70f, 0.80f, 1.00f);
-            break;
-        case 3:
-            world = two_perlin_spheres();
-            lookfrom = point3(13.0f, 2.0f, 3.0f);
-            lookat = point3(0.0f, 0.0f, 0.0f);
-            vfov = 20.0f;
-            background = color(0.70f, 0.80f, 1.00f);
-            break;
-        case 4:
-            world = earth();
-            lookfrom = point3(13.0f, 2.0f, 3.0f);
-            lookat = point3(0.0f, 0.0f, 0.0f);
-            vfov = 20.0f;
-            background = color(0.70f, 0.80f, 1.00f);
-            break;
-        case 5:
-            world = simple_light();
-            rs.samples_per_pixel = 400;
-            background = color(0.0f, 0.0f, 0.0f);
-            lookfrom = point3(26.0f, 3.0f, 6.0f);
-            lookat = point3(0.0f, 2.0f, 0.0f);
-            vfov = 20.0f;
-            break;
-        case 6:
-            world = cornell_box();
-            aspect_ratio = 1.0f;
-            rs.image_width = 600;
-            rs.samples_per_pixel = 1000;
-            background = color(0.0f, 0.0f, 0.0f);
-            lookfrom = point3(278.0f, 278.0f, -800.0f);
-            lookat = point3(278.0f, 278.0f, 0.0f);
-            // dist_to_focus = 800.0f;
-            vfov = 40.0f;
-            // lights =
-            //  make_shared<xz_rect>(213.0f, 343.0f, 227.0f, 332.0f, 554.0f, shared_ptr<material>());
-
-            // lights =
-            //   make_shared<sphere>(point3(190, 90, 190), 90.0f, shared_ptr<material>());
-
-            lights->add(make_shared<xz_rect>(213.0f, 343.0f, 227.0f, 332.0f, 554.0f, shared_ptr<material>()));
-            lights->add(make_shared<sphere>(point3(190, 90, 190), 90.0f, shared_ptr<material>()));
-            break;
-        case 7:
-            world = cornell_smoke();
-            aspect_ratio = 1.0f;
-            rs.image_width = 600;
-            rs.samples_per_pixel = 200;
-            lookfrom = point3(278.0f, 278.0f, -800.0f);
-            lookat = point3(278.0f, 278.0f, 0.0f);
-            vfov = 40.0f;
-            break;
-        case 8: {
-            veach_mis(world, lights);
-            aspect_ratio = 1.0f;
-            rs.image_width = 600;
-            rs.samples_per_pixel = 10;
-            background = color(0.0f, 0.0f, 1.0f);
-            lookfrom = point3(0.0f, 0.0f, -10.0f);
-            lookat = point3(0.0f, 0.0f, 0.0f);
-            vfov = 40.0f;
-        } break;
-
-        default:
-        case 9:
-            world = final_scene();
-            aspect_ratio = 1.0f;
-            rs.image_width = 800;
-            rs.samples_per_pixel = 10000;
-            background = color(0, 0, 0);
-            lookfrom = point3(478, 278, -600);
-            lookat = point3(278, 278, 0);
-            vfov = 40.0f;
-            break;
+    background = color(0.0f, 0.0f, 0.0f);
+
+    scene_parser parser(filename, text.data(), rs, world, *lights, materials, background);
+    try {
+        parser.parse();
+    } catch (const scene_error& error) {
+        std::cerr << filename << ":" << error.line << ": " << error.what << std::endl;
+        return false;
     }
-    vec3 vup(0.0f, 1.0f, 0.0f);
 
     // finalize the image dimensions
-    rs.setWidthAndAspect(rs.image_width, aspect_ratio);
-
-    auto time0 = 0.0f;
-    auto time1 = 1.0f;
+    rs.setWidthAndAspect(rs.image_width, parser.aspect_ratio);
+    cam = parser.make_camera();
+
+    auto ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cerr << "Scene " << filename << ": " << parser.primitives << " primitives, " << materials.size()
+              << " materials (" << parser.shared_materials << " more shared), " << parser.textures.size()
+              << " textures (" << parser.shared_textures << " more shared), read in " << ms << " ms" << std::endl;
+    return true;
+}
 
-    cam = camera(lookfrom, lookat, vup, vfov, aspect_ratio, aperture, dist_to_focus, time0, time1);
-}
\ No newline at end of file
+std::string
+builtin_scene_file(int number, const std::string& executable_path)
+{
+    if (number < 1 || number > static_cast<int>(sizeof(builtin_scenes) / sizeof(builtin_scenes[0])))
+        return std::string();
+    auto relative = std::filesystem::path("scenes") / (std::string(builtin_scenes[number - 1]) + ".scene");
+    std::error_code error;
+    auto beside_executable = std::filesystem::path(executable_path).parent_path() / relative;
+    if (!executable_path.empty() && std::filesystem::is_regular_file(beside_executable, error))
+        return beside_executable.string();
+    return relative.string();
+}
@@ -3,15 +3,45 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include "bvh_node.h"
 #include "camera.h"
 #include "hittable_list.h"
+#include "material.h"
+#include "sampler.h"
+
+#include <cstdint>
+#include <string>
+
+// how the color of a camera ray is estimated
+enum class integrator_type
+{
+    // ray_color: recursion to max_path_size
+    recursive,
+    // path_color: a loop, ending paths early by Russian roulette
+    path,
+    // the same paths as path, traced a stage at a time for many of them at once
+    wavefront
+};
 
 struct render_settings
 {
     int image_width = 1;
     int image_height = 1;
+    // the most samples any pixel gets
     int samples_per_pixel = 1;
+    // adaptive sampling stops a pixel once the standard error of its mean luminance is at most this fraction of the
+    // mean, but not before min_samples; 0 always takes samples_per_pixel
+    float adaptive_error = 0.0f;
+    int min_samples = 16;
     int max_path_size = 1;
+    integrator_type integrator = integrator_type::path;
+    sampler_type sampler = sampler_type::sobol;
+    // the image is rendered in square tiles of this many pixels a side
+    int tile_size = 32;
+    // used for every bvh_node the scene builds
+    bvh_build_options bvh;
+    // camera rays traced together in a ray_packet, 4, 8 or 16; 0 traces every ray on its own
+    int packet_width = 0;
 
     void setWidthAndAspect(int width, float aspect)
     {
@@ -20,31 +50,60 @@ struct render_settings
     }
 };
 
-void
-load_scene(int scenetype, render_settings& rs, hittable_list& world, shared_ptr<hittable_list>& lights, camera& cam, color& background);
-
-hittable_list
-two_spheres();
-
-hittable_list
-random_scene();
-
-hittable_list
-two_perlin_spheres();
-
-hittable_list
-earth();
-
-hittable_list
-simple_light();
-
-hittable_list
-cornell_box();
+// Scene files
+//
+// A scene is a text file of statements, separated by any white space; # starts a comment that runs to the end of
+// the line. Numbers are decimal, vectors and colors are three numbers, and file names are in double quotes, relative
+// to the directory of the scene file if they are there and to the working directory otherwise.
+//
+//   render { width 600 aspect 1 samples 1000 max_depth 50 background 0 0 0 }
+//   camera { lookfrom 278 278 -800 lookat 278 278 0 vup 0 1 0 vfov 40 aperture 0 focus_dist 10 time 0 1 }
+//   texture NAME TEXTURE
+//   material NAME MATERIAL
+//   define NAME OBJECT         names an object without putting it in the world, for any number of uses
+//   instance NAME STEPS        places a defined object; all instances share one two level structure
+//   light OBJECT               a shape for lights to be sampled on; its materials are left out
+//   OBJECT                     goes in the world
+//
+// aspect is one number or a width and a height; any setting left out keeps its default.
+//
+//   TEXTURE  = r g b | solid r g b | checker TEXTURE TEXTURE | noise scale | image "file" | NAME
+//   MATERIAL = lambertian TEXTURE | metal r g b fuzz | dielectric index | diffuse_light TEXTURE
+//            | isotropic TEXTURE | NAME
+//   OBJECT   = sphere center radius MATERIAL
+//            | moving_sphere center0 center1 time0 time1 radius MATERIAL
+//            | xy_rect x0 x1 y0 y1 k MATERIAL | xz_rect x0 x1 z0 z1 k MATERIAL | yz_rect y0 y1 z0 z1 k MATERIAL
+//            | box min max MATERIAL
+//            | mesh "file" MATERIAL        an OBJ or PLY file, by way of its cache
+//            | flip_face OBJECT
+//            | transform STEPS OBJECT
+//            | medium density TEXTURE OBJECT
+//            | group { OBJECT ... }
+//            | bvh { OBJECT ... }
+//            | NAME
+//   STEPS    = translate x y z | scale x y z | scale s | rotate_x degrees | rotate_y degrees | rotate_z degrees
+//            | fit size, any number of them
+//
+// Steps compose the way they read, so the last one is applied to the object first. fit scales the object evenly to
+// make its longest side size and stands the middle of the bottom of its box on the origin; it has to be the last step.
+// Textures and materials are made once for each distinct definition, however many times they are written, so the
+// scene's objects share them whether they were named or not. Keywords take precedence over names.
 
-hittable_list
-cornell_smoke();
+// Reads the scene in filename, with the settings it has for the image and the camera, and content_hash of its text.
+// Returns false, after saying where and why on std::cerr, if it cannot be read or parsed.
+bool
+load_scene(const std::string& filename,
+           render_settings& rs,
+           hittable_list& world,
+           shared_ptr<hittable_list>& lights,
+           material_table& materials,
+           camera& cam,
+           color& background,
+           uint64_t& scene_hash);
 
-hittable_list
-final_scene();
+// The file of one of the scenes that come with the renderer, by its number from 1, in the scenes directory beside the
+// executable at executable_path, or else in the working directory's; empty if there is no such scene.
+std::string
+builtin_scene_file(int number, const std::string& executable_path);
 
 #endif
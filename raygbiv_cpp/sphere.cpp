@@ -3,7 +3,7 @@
 #include "onb.h"
 
 bool
-sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+sphere::intersect_t(const ray& r, float t_min, float t_max, float& t) const
 {
     vec3 oc = r.origin() - center;
     auto a = glm::length2(r.direction());
@@ -23,14 +23,43 @@ sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
             return false;
     }
 
-    rec.t = root;
-    rec.p = r.at(rec.t);
+    t = root;
+    return true;
+}
+
+void
+sphere::intersect_packet(ray_packet& packet, uint32_t lanes) const
+{
+    const simd_float center_x = simd_set(center.x), center_y = simd_set(center.y), center_z = simd_set(center.z);
+    auto center_of = [&](int, simd_float& x, simd_float& y, simd_float& z) {
+        x = center_x;
+        y = center_y;
+        z = center_z;
+    };
+    alignas(64) float t[ray_packet::max_width];
+    packet.record_deferred(packet_sphere_test(packet, lanes, center_of, radius, t), t, this);
+}
+
+bool
+sphere::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    float t;
+    if (!sphere::intersect_t(r, t_min, t_max, t))
+        return false;
+
+    sphere::fill_hit(r, t, 0.0f, 0.0f, rec);
+    return true;
+}
+
+void
+sphere::fill_hit(const ray& r, float t, float, float, hit_record& rec) const
+{
+    rec.t = t;
+    rec.p = r.at(t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat_ptr = mat_ptr;
-
-    return true;
+    rec.mat_id = mat_id;
 }
 
 bool
@@ -43,8 +72,8 @@ sphere::bounding_box(float time0, float time1, aabb& output_box) const
 float
 sphere::pdf_value(const point3& o, const vec3& v) const
 {
-    hit_record rec;
-    if (!this->hit(ray(o, v), RAY_EPSILON, infinity, rec))
+    float t;
+    if (!sphere::intersect_t(ray(o, v), RAY_EPSILON, infinity, t))
         return 0;
 
     auto cos_theta_max = sqrt(1 - radius * radius / glm::length2(center - o));
@@ -54,11 +83,11 @@ sphere::pdf_value(const point3& o, const vec3& v) const
 }
 
 vec3
-sphere::random(const point3& o) const
+sphere::random(const point3& o, const vec2& u) const
 {
     vec3 direction = center - o;
     auto distance_squared = glm::length2(direction);
     onb uvw;
     uvw.build_from_w(direction);
-    return uvw.local(random_to_sphere(radius, distance_squared));
+    return uvw.local(random_to_sphere(radius, distance_squared, u));
 }
@@ -4,27 +4,32 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "ray_packet.h"
 #include "vec3.h"
 
-class sphere : public hittable
+class sphere : public deferred_hittable
 {
   public:
     sphere()
       : radius(0)
+      , mat_id(0)
     {}
-    sphere(point3 cen, float r, shared_ptr<material> m)
+    sphere(point3 cen, float r, uint32_t m)
       : center(cen)
       , radius(r)
-      , mat_ptr(m){};
+      , mat_id(m){};
     virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override;
+    virtual void fill_hit(const ray& r, float t, float a, float b, hit_record& rec) const override;
     virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
     float pdf_value(const point3& o, const vec3& v) const override;
-    vec3 random(const point3& o) const override;
+    vec3 random(const point3& o, const vec2& u) const override;
 
   public:
     point3 center;
     float radius;
-    shared_ptr<material> mat_ptr;
+    uint32_t mat_id;
 
   private:
     static void get_sphere_uv(const point3& p, float& u, float& v)
@@ -44,4 +49,51 @@ class sphere : public hittable
     }
 };
 
+// The lanes of the packet whose rays hit a sphere of radius nearer than their t_max, with the distances in t.
+// center_of(first, x, y, z) gives the centers for the SIMD group of lanes from first on. Works the roots out as
+// sphere::intersect_t does.
+template<class Center>
+uint32_t
+packet_sphere_test(const ray_packet& packet, uint32_t lanes, Center&& center_of, float radius, float* t)
+{
+    const simd_float t_min = simd_set(packet.t_min);
+    const simd_float zero = simd_set(0.0f);
+    const simd_float radius_squared = simd_set(radius * radius);
+    uint32_t hits = 0;
+    for (int first = 0; first < ray_packet::max_width && (lanes >> first) != 0; first += simd_float::width) {
+        uint32_t group = (lanes >> first) & ((1u << simd_float::width) - 1);
+        if (group == 0)
+            continue;
+        simd_float dx = simd_load(packet.direction_x + first);
+        simd_float dy = simd_load(packet.direction_y + first);
+        simd_float dz = simd_load(packet.direction_z + first);
+        simd_float center_x, center_y, center_z;
+        center_of(first, center_x, center_y, center_z);
+        simd_float ocx = simd_load(packet.origin_x + first) - center_x;
+        simd_float ocy = simd_load(packet.origin_y + first) - center_y;
+        simd_float ocz = simd_load(packet.origin_z + first) - center_z;
+
+        simd_float a = dx * dx + dy * dy + dz * dz;
+        simd_float half_b = ocx * dx + ocy * dy + ocz * dz;
+        simd_float c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius_squared;
+        simd_float discriminant = half_b * half_b - a * c;
+        simd_float sqrtd = simd_sqrt(simd_max(discriminant, zero));
+
+        // the nearest root in [t_min, t_max], as in the scalar test
+        simd_float t_max = simd_load(packet.t_max + first);
+        simd_float near = (zero - half_b - sqrtd) / a;
+        simd_float far = (zero - half_b + sqrtd) / a;
+        simd_float near_ok = (near >= t_min) & (near <= t_max);
+        simd_float far_ok = (far >= t_min) & (far <= t_max);
+        simd_float hit = (discriminant >= zero) & (near_ok | far_ok);
+
+        uint32_t group_hits = static_cast<uint32_t>(simd_bits(hit)) & group;
+        if (group_hits != 0) {
+            simd_store(t + first, simd_select(near_ok, near, far));
+            hits |= group_hits << first;
+        }
+    }
+    return hits;
+}
+
 #endif
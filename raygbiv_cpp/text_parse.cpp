@@ -0,0 +1,102 @@
+#include "text_parse.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+
+bool
+read_file(const std::string& filename, std::vector<char>& data)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+        return false;
+    in.seekg(0, std::ios::end);
+    auto size = static_cast<size_t>(in.tellg());
+    in.seekg(0, std::ios::beg);
+    data.resize(size + 1);
+    in.read(data.data(), size);
+    data[size] = 0;
+    return static_cast<size_t>(in.gcount()) == size;
+}
+
+const char*
+parse_float(const char* p, float& value)
+{
+    static const double powers_of_ten[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char* start = p;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+')
+        ++p;
+
+    // the first 19 significant digits fit a 64 bit integer, and later ones only scale it
+    uint64_t mantissa = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    bool any_digits = false;
+    for (; is_digit(*p); ++p, any_digits = true) {
+        if (significant_digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant_digits += mantissa != 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (*p == '.') {
+        for (++p; is_digit(*p); ++p, any_digits = true) {
+            if (significant_digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant_digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char* e = p + 1;
+        bool negative_exponent = *e == '-';
+        if (*e == '-' || *e == '+')
+            ++e;
+        if (!is_digit(*e))
+            any_digits = false;
+        int written_exponent = 0;
+        for (; is_digit(*e); ++e) {
+            written_exponent = std::min(written_exponent * 10 + (*e - '0'), 10000);
+        }
+        exponent += negative_exponent ? -written_exponent : written_exponent;
+        p = e;
+    }
+    if (!any_digits) {
+        char* end;
+        double d = std::strtod(start, &end);
+        if (end == start)
+            return nullptr;
+        value = static_cast<float>(d);
+        return end;
+    }
+
+    double d = static_cast<double>(mantissa);
+    if (exponent < 0)
+        d = -exponent <= 22 ? d / powers_of_ten[-exponent] : d * std::pow(10.0, exponent);
+    else if (exponent > 0)
+        d = exponent <= 22 ? d * powers_of_ten[exponent] : d * std::pow(10.0, exponent);
+    value = static_cast<float>(negative ? -d : d);
+    return p;
+}
+
+const char*
+parse_int(const char* p, long long& value)
+{
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+')
+        ++p;
+    if (!is_digit(*p))
+        return nullptr;
+    long long v = 0;
+    for (; is_digit(*p); ++p) {
+        v = std::min(v * 10 + (*p - '0'), 1ll << 40);
+    }
+    value = negative ? -v : v;
+    return p;
+}
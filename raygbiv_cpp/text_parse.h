@@ -0,0 +1,32 @@
+#pragma once
+
+#ifndef TEXT_PARSE_H
+#define TEXT_PARSE_H
+
+#include <string>
+#include <vector>
+
+// Helpers for the readers of text files, the mesh loaders and the scene parser, which read the whole file into memory
+// and parse it in place.
+
+// the whole file, followed by a zero so the parsers can look one character ahead without checking for the end
+bool
+read_file(const std::string& filename, std::vector<char>& data);
+
+inline bool
+is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Parses a decimal number the way strtod does, but without its locale lookups, which take most of the time of
+// reading a large OBJ file. Anything it does not expect, such as inf or nan, is left to strtod. Returns where the
+// number ends, or nullptr if there is none.
+const char*
+parse_float(const char* p, float& value);
+
+// a decimal integer with an optional sign; returns where it ends, or nullptr if there is none
+const char*
+parse_int(const char* p, long long& value);
+
+#endif
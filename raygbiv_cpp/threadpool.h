@@ -4,6 +4,9 @@
 #define THREADPOOL_H
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <deque>
 #include <functional>
 #include <future>
@@ -18,18 +21,14 @@
 
 namespace raygbiv {
 
+// A work-stealing pool.  Every worker thread owns a deque of tasks: tasks a
+// worker queues go to the back of its own deque and it takes its next task
+// from the back as well, so it keeps working on what it touched last.  A
+// worker with an empty deque takes tasks queued from outside the pool, in the
+// order they were queued, and after that steals from the front of the other
+// workers' deques, where the oldest and usually largest tasks are.
 struct Tasks
 {
-    // the mutex, condition variable and deque form a single
-    // thread-safe triggered queue of tasks:
-    std::mutex m;
-    std::condition_variable v;
-    // note that a packaged_task<void> can store a packaged_task<R>:
-    std::deque<std::packaged_task<bool()>> work;
-
-    // this holds futures representing the worker threads being done:
-    std::vector<std::future<void>> finished;
-
     // queue( lambda ) will enqueue the lambda into the tasks for the threads
     // to use.  A future of the type the lambda returns is given to let you get
     // the result out.
@@ -41,9 +40,15 @@ struct Tasks
         std::packaged_task<R()> p(std::forward<F>(f));
 
         auto r = p.get_future(); // get the return value before we hand off the task
+        task_deque& d = current.pool == this ? *workers[current.index] : injected;
+        {
+            std::unique_lock<std::mutex> l(d.m);
+            d.work.emplace_back(std::move(p)); // store the task<R()> as a task<void()>
+            pending++;
+        }
+        // taking the lock orders this with a worker checking for work before it sleeps:
         {
             std::unique_lock<std::mutex> l(m);
-            work.emplace_back(std::move(p)); // store the task<R()> as a task<void()>
         }
         v.notify_one(); // wake a thread to work on the task
 
@@ -53,12 +58,43 @@ struct Tasks
     // start N threads in the thread pool.
     void start(std::size_t N = 1)
     {
+        // the deques are created before any thread runs, so workers can
+        // read the list without locking:
+        std::size_t first = workers.size();
         for (std::size_t i = 0; i < N; ++i) {
+            workers.push_back(std::make_unique<task_deque>());
+        }
+        for (std::size_t i = first; i < workers.size(); ++i) {
             // each thread is a std::async running this->thread_task():
-            finished.push_back(std::async(std::launch::async, [this] { thread_task(); }));
+            finished.push_back(std::async(std::launch::async, [this, i] { thread_task(i); }));
         }
     }
 
+    // run_pending() takes one queued task and runs it on the calling thread.
+    // Returns false if there was nothing to run.
+    bool run_pending()
+    {
+        std::packaged_task<bool()> f;
+        if (!take(current.pool == this ? current.index : workers.size(), f))
+            return false;
+        f();
+        return true;
+    }
+
+    // wait( future ) waits for a task queued on this pool, running other queued
+    // tasks in the meantime.  A task that queues more tasks and waits for them
+    // this way keeps its thread busy instead of blocking the pool.
+    template<class R>
+    R wait(std::future<R>& r)
+    {
+        while (r.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            // with nothing left to take the task is already running somewhere:
+            if (!run_pending())
+                r.wait();
+        }
+        return r.get();
+    }
+
     // abort() cancels all non-started tasks, and tells every working thread
     // stop running, and waits for them to finish up.
     void abort()
@@ -69,46 +105,114 @@ struct Tasks
     // cancel_pending() merely cancels all non-started tasks:
     void cancel_pending()
     {
-        std::unique_lock<std::mutex> l(m);
-        work.clear();
+        cancel(injected);
+        for (auto& d : workers) {
+            cancel(*d);
+        }
     }
-    // finish enques a "stop the thread" message for every thread, then waits for them:
+    // finish tells every thread to stop once there is no work left, then waits for them:
     void finish()
     {
         {
             std::unique_lock<std::mutex> l(m);
-            for (auto&& unused : finished) {
-                work.push_back({});
-            }
+            stopping = true;
         }
         v.notify_all();
         finished.clear();
+        workers.clear();
+        stopping = false;
     }
     ~Tasks() { finish(); }
 
   private:
+    struct task_deque
+    {
+        std::mutex m;
+        // note that a packaged_task<void> can store a packaged_task<R>:
+        std::deque<std::packaged_task<bool()>> work;
+    };
+
+    // which pool, if any, the calling thread works for; like every
+    // thread_local it starts out zeroed, which means none:
+    struct worker_id
+    {
+        Tasks* pool;
+        std::size_t index;
+    };
+    inline static thread_local worker_id current;
+
+    // take( self, f ) finds a task for worker self (or for a thread outside
+    // the pool if self is not a worker index):
+    bool take(std::size_t self, std::packaged_task<bool()>& f)
+    {
+        std::size_t n = workers.size();
+        if (self < n && pop(*workers[self], f, true))
+            return true;
+        if (pop(injected, f, false))
+            return true;
+        for (std::size_t i = 1; i <= n; ++i) {
+            if (pop(*workers[(self + i) % n], f, false))
+                return true;
+        }
+        return false;
+    }
+
+    bool pop(task_deque& d, std::packaged_task<bool()>& f, bool back)
+    {
+        std::unique_lock<std::mutex> l(d.m);
+        if (d.work.empty())
+            return false;
+        if (back) {
+            f = std::move(d.work.back());
+            d.work.pop_back();
+        } else {
+            f = std::move(d.work.front());
+            d.work.pop_front();
+        }
+        pending--;
+        return true;
+    }
+
+    void cancel(task_deque& d)
+    {
+        std::unique_lock<std::mutex> l(d.m);
+        pending -= d.work.size();
+        d.work.clear();
+    }
+
     // the work that a worker thread does:
-    void thread_task()
+    void thread_task(std::size_t index)
     {
+        current = { this, index };
         while (true) {
-            // pop a task off the queue:
             std::packaged_task<bool()> f;
-            {
-                // usual thread-safe queue code:
-                std::unique_lock<std::mutex> l(m);
-                if (work.empty()) {
-                    v.wait(l, [&] { return !work.empty(); });
-                }
-                f = std::move(work.front());
-                work.pop_front();
+            if (take(index, f)) {
+                f();
+                continue;
             }
-            // if the task is invalid, it means we are asked to abort:
-            if (!f.valid())
+            // nothing to take: sleep until something is queued, or stop
+            // once we are asked to and the work has run out:
+            std::unique_lock<std::mutex> l(m);
+            v.wait(l, [&] { return pending > 0 || stopping; });
+            if (pending == 0 && stopping)
                 return;
-            // otherwise, run the task:
-            f();
         }
     }
+
+    // one deque per worker thread, plus one for tasks queued from outside
+    // the pool:
+    std::vector<std::unique_ptr<task_deque>> workers;
+    task_deque injected;
+    // tasks queued and not taken yet, across all deques:
+    std::atomic<std::size_t> pending{ 0 };
+
+    // the mutex and condition variable put idle workers to sleep:
+    std::mutex m;
+    std::condition_variable v;
+    bool stopping = false;
+
+    // this holds futures representing the worker threads being done:
+    std::vector<std::future<void>> finished;
 };
 
 } // namespace raygbiv
@@ -0,0 +1,137 @@
+#include "tlas.h"
+
+#include <chrono>
+#include <iostream>
+
+#include "bvh_traversal.h"
+
+uint32_t
+tlas::add_blas(shared_ptr<hittable> object)
+{
+    aabb bounds;
+    if (!object->bounding_box(0, 1, bounds))
+        std::cerr << "No bounding box for tlas blas.\n";
+    blases.push_back(object);
+    blas_boxes.push_back(bounds);
+    return static_cast<uint32_t>(blases.size() - 1);
+}
+
+void
+tlas::reserve(size_t n_instances)
+{
+    instances.reserve(n_instances);
+    instance_boxes.reserve(n_instances);
+    instance_slots.reserve(n_instances);
+}
+
+uint32_t
+tlas::add_instance(uint32_t blas, const affine_transform& object_to_world)
+{
+    auto id = static_cast<uint32_t>(instance_slots.size());
+    instances.push_back({ object_to_world.inverse(), blas, id });
+    instance_boxes.push_back(object_to_world.box(blas_boxes[blas]));
+    instance_slots.push_back(static_cast<uint32_t>(instances.size() - 1));
+    return id;
+}
+
+void
+tlas::set_transform(uint32_t id, const affine_transform& object_to_world)
+{
+    auto& instance = instances[instance_slots[id]];
+    instance.world_to_object = object_to_world.inverse();
+    instance_boxes[id] = object_to_world.box(blas_boxes[instance.blas]);
+}
+
+void
+tlas::build(const bvh_build_options& options)
+{
+    nodes.clear();
+    nodes4.clear();
+    nodes8.clear();
+    if (instances.empty())
+        return;
+
+    auto build_start = std::chrono::high_resolution_clock::now();
+
+    auto order = build_nodes(
+      instances.size(),
+      [&](size_t i, aabb& bounds) { bounds = instance_boxes[instances[i].id]; },
+      options);
+
+    std::vector<tlas_instance> sorted(instances.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        sorted[i] = instances[order[i]];
+        instance_slots[sorted[i].id] = static_cast<uint32_t>(i);
+    }
+    instances = std::move(sorted);
+
+    auto build_end = std::chrono::high_resolution_clock::now();
+    stats.build_ms = std::chrono::duration<float, std::milli>(build_end - build_start).count();
+}
+
+void
+tlas::refit()
+{
+    // children always come after their parent, so going backwards visits them first
+    for (size_t n = nodes.size(); n-- > 0;) {
+        auto& node = nodes[n];
+        if (node.n_primitives > 0) {
+            node.bounds = instance_boxes[instances[node.primitives_offset].id];
+            for (int i = 1; i < node.n_primitives; ++i) {
+                node.bounds = surrounding_box(node.bounds, instance_boxes[instances[node.primitives_offset + i].id]);
+            }
+        } else {
+            node.bounds = surrounding_box(nodes[n + 1].bounds, nodes[node.second_child_offset].bounds);
+        }
+    }
+    if (!nodes.empty())
+        box = nodes[0].bounds;
+}
+
+bool
+tlas::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    return traverse<false>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        const auto& instance = instances[i];
+        if (!blases[instance.blas]->hit(to_object(instance, r), t_min, t_max, rec))
+            return false;
+        t_max = rec.t;
+        // the normal already faces the ray, and the transform keeps it that way
+        rec.p = r.at(rec.t);
+        vec3 normal = instance.world_to_object.transposed_vector(rec.normal);
+        rec.normal = normal / std::sqrt(dot(normal, normal));
+        return true;
+    });
+}
+
+bool
+tlas::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    return traverse<false>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        const auto& instance = instances[i];
+        float object_t;
+        if (!blases[instance.blas]->intersect_t(to_object(instance, r), t_min, t_max, object_t))
+            return false;
+        t = t_max = object_t;
+        return true;
+    });
+}
+
+bool
+tlas::occluded(const ray& r, float t_min, float t_max) const
+{
+    return traverse<true>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        const auto& instance = instances[i];
+        return blases[instance.blas]->occluded(to_object(instance, r), t_min, t_max);
+    });
+}
+
+bool
+tlas::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (nodes.empty())
+        return false;
+
+    output_box = box;
+    return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#ifndef TLAS_H
+#define TLAS_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh_node.h"
+#include "transform.h"
+
+// One placement of a bottom level structure in the world. Only the map into the structure's own space is kept, as
+// the hit point can be found on the world ray itself.
+struct tlas_instance
+{
+    affine_transform world_to_object;
+    // the structure placed, in tlas::blases
+    uint32_t blas;
+    // what tlas::add_instance returned for this instance, which stays the same when the tree is rebuilt
+    uint32_t id;
+};
+
+// A two level acceleration structure: a top level tree (TLAS) over instances, each of which places one of a few
+// shared bottom level structures (BLAS, usually bvh_nodes over the primitives of a mesh) with an affine transform.
+// An instance costs its record, its world box and a share of the top level nodes, some 110 bytes, so millions of
+// them fit where millions of transform_instance wrappers would not. When only the transforms change, refit()
+// updates the boxes of the existing tree instead of building a new one.
+class tlas : public bvh_node
+{
+  public:
+    // adds a bottom level structure that instances can refer to, and returns its index
+    uint32_t add_blas(shared_ptr<hittable> object);
+
+    // makes room for this many instances in all, so that adding millions of them does not leave the vectors with
+    // spare capacity
+    void reserve(size_t n_instances);
+
+    // places blas in the world and returns the instance's id; takes effect at the next build()
+    uint32_t add_instance(uint32_t blas, const affine_transform& object_to_world);
+
+    // moves an instance; the tree is stale until the next refit() or build()
+    void set_transform(uint32_t id, const affine_transform& object_to_world);
+
+    // builds the top level tree over all instances; the tree is always binary, so that it can be refit
+    void build(const bvh_build_options& options = bvh_build_options());
+
+    // Updates the boxes of the tree, bottom up, for the instances' current transforms, keeping its shape. Much faster
+    // than build(), but the tree gets worse the further the instances move from where they were when it was built.
+    void refit();
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+
+    // its tree holds instances rather than the objects bvh_node's packet traversal expects, so the lanes are traced
+    // one at a time
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override
+    {
+        hittable::intersect_packet(packet, lanes);
+    }
+
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+  public:
+    std::vector<shared_ptr<hittable>> blases;
+    // the box of each blas over the whole shutter interval
+    std::vector<aabb> blas_boxes;
+    // in the order the leaves refer to them once built
+    std::vector<tlas_instance> instances;
+    // world box of each instance, by id
+    std::vector<aabb> instance_boxes;
+    // position of each instance in instances, by id
+    std::vector<uint32_t> instance_slots;
+
+  private:
+    // the ray in the space of an instance; its direction is not normalized, so distances along it stay the same
+    static ray to_object(const tlas_instance& instance, const ray& r)
+    {
+        const auto& m = instance.world_to_object;
+        return ray(m.point(r.origin()), m.vector(r.direction()), r.time());
+    }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "transform.h"
+
+affine_transform::affine_transform()
+{
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++)
+            m[r][c] = r == c ? 1.0f : 0.0f;
+    }
+}
+
+affine_transform
+affine_transform::translation(const vec3& offset)
+{
+    affine_transform t;
+    t.m[0][3] = offset.x;
+    t.m[1][3] = offset.y;
+    t.m[2][3] = offset.z;
+    return t;
+}
+
+affine_transform
+affine_transform::scaling(const vec3& factors)
+{
+    affine_transform t;
+    t.m[0][0] = factors.x;
+    t.m[1][1] = factors.y;
+    t.m[2][2] = factors.z;
+    return t;
+}
+
+// the rotation in the plane of axes a and b that turns a toward b
+static affine_transform
+plane_rotation(int a, int b, float degrees)
+{
+    auto radians = degrees_to_radians(degrees);
+    auto sin_theta = sin(radians);
+    auto cos_theta = cos(radians);
+    affine_transform t;
+    t.m[a][a] = cos_theta;
+    t.m[a][b] = -sin_theta;
+    t.m[b][a] = sin_theta;
+    t.m[b][b] = cos_theta;
+    return t;
+}
+
+affine_transform
+affine_transform::rotation_x(float degrees)
+{
+    return plane_rotation(1, 2, degrees);
+}
+
+affine_transform
+affine_transform::rotation_y(float degrees)
+{
+    return plane_rotation(2, 0, degrees);
+}
+
+affine_transform
+affine_transform::rotation_z(float degrees)
+{
+    return plane_rotation(0, 1, degrees);
+}
+
+affine_transform
+affine_transform::operator*(const affine_transform& b) const
+{
+    affine_transform t;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 4; c++) {
+            t.m[r][c] = m[r][0] * b.m[0][c] + m[r][1] * b.m[1][c] + m[r][2] * b.m[2][c] + (c == 3 ? m[r][3] : 0.0f);
+        }
+    }
+    return t;
+}
+
+affine_transform
+affine_transform::inverse() const
+{
+    // the inverse of the linear part is its adjugate over its determinant, and the translation is undone after it
+    affine_transform t;
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            int r1 = (c + 1) % 3, r2 = (c + 2) % 3;
+            int c1 = (r + 1) % 3, c2 = (r + 2) % 3;
+            t.m[r][c] = m[r1][c1] * m[r2][c2] - m[r1][c2] * m[r2][c1];
+        }
+    }
+    float det = m[0][0] * t.m[0][0] + m[0][1] * t.m[1][0] + m[0][2] * t.m[2][0];
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++)
+            t.m[r][c] /= det;
+    }
+    vec3 offset = t.vector(vec3(m[0][3], m[1][3], m[2][3]));
+    t.m[0][3] = -offset.x;
+    t.m[1][3] = -offset.y;
+    t.m[2][3] = -offset.z;
+    return t;
+}
+
+aabb
+affine_transform::box(const aabb& box) const
+{
+    point3 min(infinity, infinity, infinity);
+    point3 max(-infinity, -infinity, -infinity);
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 2; k++) {
+                auto x = i * box.max().x + (1 - i) * box.min().x;
+                auto y = j * box.max().y + (1 - j) * box.min().y;
+                auto z = k * box.max().z + (1 - k) * box.min().z;
+
+                vec3 tester = point(point3(x, y, z));
+
+                for (int c = 0; c < 3; c++) {
+                    min[c] = fmin(min[c], tester[c]);
+                    max[c] = fmax(max[c], tester[c]);
+                }
+            }
+        }
+    }
+
+    return aabb(min, max);
+}
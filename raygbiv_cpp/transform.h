@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "aabb.h"
+#include "rtweekend.h"
+#include "vec3.h"
+
+// An affine map of 3d space, stored as the top three rows of a 4x4 matrix: a linear part in the first three columns
+// and a translation in the last. Transforms compose like matrices, so a * b applies b first, and rotations turn
+// counterclockwise about their axis when it points at the viewer.
+class affine_transform
+{
+  public:
+    // the identity
+    affine_transform();
+
+    static affine_transform translation(const vec3& offset);
+    static affine_transform scaling(const vec3& factors);
+    static affine_transform rotation_x(float degrees);
+    static affine_transform rotation_y(float degrees);
+    static affine_transform rotation_z(float degrees);
+
+    affine_transform operator*(const affine_transform& b) const;
+
+    // the map undoing this one; the linear part has to be invertible
+    affine_transform inverse() const;
+
+    point3 point(const point3& p) const
+    {
+        return point3(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                      m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                      m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+
+    // directions and offsets, which the translation does not move
+    vec3 vector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                    m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                    m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+
+    // a normal is mapped by the transpose of the inverse, so call this on the inverse of the map the surface is
+    // moved by; the result is not normalized
+    vec3 transposed_vector(const vec3& n) const
+    {
+        return vec3(m[0][0] * n.x + m[1][0] * n.y + m[2][0] * n.z,
+                    m[0][1] * n.x + m[1][1] * n.y + m[2][1] * n.z,
+                    m[0][2] * n.x + m[1][2] * n.y + m[2][2] * n.z);
+    }
+
+    // the smallest box around the mapped corners of box
+    aabb box(const aabb& box) const;
+
+  public:
+    float m[3][4];
+};
+
+#endif
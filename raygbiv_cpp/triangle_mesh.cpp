@@ -0,0 +1,208 @@
+#include "triangle_mesh.h"
+
+#include <chrono>
+#include <utility>
+
+#include "bvh_traversal.h"
+
+triangle_mesh::triangle_mesh(mesh_buffers buffers, uint32_t mat_id, const bvh_build_options& options)
+  : mesh(std::move(buffers))
+  , mat_id(mat_id)
+{
+    geometry = mesh_view(mesh);
+    size_t count = mesh.triangle_count();
+    if (count == 0)
+        return;
+
+    auto build_start = std::chrono::high_resolution_clock::now();
+
+    auto order = build_nodes(
+      count,
+      [&](size_t i, aabb& bounds) {
+          const uint32_t* v = &mesh.indices[3 * i];
+          auto p0 = position(v[0]);
+          auto p1 = position(v[1]);
+          auto p2 = position(v[2]);
+          auto lo = glm::min(glm::min(p0, p1), p2);
+          auto hi = glm::max(glm::max(p0, p1), p2);
+          // a triangle in an axis plane has a flat box, which the slab test misses when the ray enters and leaves
+          // it at the same distance
+          auto extent = hi - lo;
+          auto pad = vec3(1e-4f * std::fmax(extent.x, std::fmax(extent.y, extent.z)));
+          bounds = aabb(lo - pad, hi + pad);
+      },
+      options);
+
+    // leaves cover the triangles in this order
+    std::vector<uint32_t> sorted(mesh.indices.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        for (int k = 0; k < 3; ++k) {
+            sorted[3 * i + k] = mesh.indices[3 * size_t(order[i]) + k];
+        }
+    }
+    mesh.indices = std::move(sorted);
+    geometry.indices = mesh.indices;
+
+    widen(options.width);
+
+    auto build_end = std::chrono::high_resolution_clock::now();
+    stats.build_ms = std::chrono::duration<float, std::milli>(build_end - build_start).count();
+}
+
+triangle_mesh::triangle_mesh(shared_ptr<const mapped_file> file, const mesh_view& geometry, uint32_t mat_id)
+  : geometry(geometry)
+  , mat_id(mat_id)
+  , file(std::move(file))
+{}
+
+triangle_mesh::watertight_ray::watertight_ray(const ray& r)
+  : origin(r.origin())
+{
+    vec3 d = r.direction();
+    vec3 a(std::fabs(d.x), std::fabs(d.y), std::fabs(d.z));
+    kz = a.x > a.y ? (a.x > a.z ? 0 : 2) : (a.y > a.z ? 1 : 2);
+    kx = kz == 2 ? 0 : kz + 1;
+    ky = kx == 2 ? 0 : kx + 1;
+    // keeps the winding of the triangles, so the signs of the edge functions mean the same on either side
+    if (d[kz] < 0.0f)
+        std::swap(kx, ky);
+    sx = d[kx] / d[kz];
+    sy = d[ky] / d[kz];
+    sz = 1.0f / d[kz];
+}
+
+bool
+triangle_mesh::intersect_triangle(const watertight_ray& r,
+                                  uint32_t i,
+                                  float t_min,
+                                  float t_max,
+                                  float& t,
+                                  float& b1,
+                                  float& b2) const
+{
+    const uint32_t* v = &geometry.indices[3 * size_t(i)];
+    vec3 a = position(v[0]) - r.origin;
+    vec3 b = position(v[1]) - r.origin;
+    vec3 c = position(v[2]) - r.origin;
+
+    // the vertices sheared into the space where the ray runs down the z axis from the origin
+    float ax = a[r.kx] - r.sx * a[r.kz];
+    float ay = a[r.ky] - r.sy * a[r.kz];
+    float bx = b[r.kx] - r.sx * b[r.kz];
+    float by = b[r.ky] - r.sy * b[r.kz];
+    float cx = c[r.kx] - r.sx * c[r.kz];
+    float cy = c[r.ky] - r.sy * c[r.kz];
+
+    // the edge functions, each twice the area of the projected triangle the ray makes with an edge
+    float e0 = cx * by - cy * bx;
+    float e1 = ax * cy - ay * cx;
+    float e2 = bx * ay - by * ax;
+
+    // a ray right through an edge: the sign decides which triangle gets it, so work it out exactly
+    if (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f) {
+        e0 = static_cast<float>(double(cx) * double(by) - double(cy) * double(bx));
+        e1 = static_cast<float>(double(ax) * double(cy) - double(ay) * double(cx));
+        e2 = static_cast<float>(double(bx) * double(ay) - double(by) * double(ax));
+    }
+
+    if ((e0 < 0.0f || e1 < 0.0f || e2 < 0.0f) && (e0 > 0.0f || e1 > 0.0f || e2 > 0.0f))
+        return false;
+    float det = e0 + e1 + e2;
+    if (det == 0.0f)
+        return false;
+
+    float az = r.sz * a[r.kz];
+    float bz = r.sz * b[r.kz];
+    float cz = r.sz * c[r.kz];
+    float inv_det = 1.0f / det;
+    float hit_t = (e0 * az + e1 * bz + e2 * cz) * inv_det;
+    if (hit_t < t_min || t_max < hit_t)
+        return false;
+
+    t = hit_t;
+    b1 = e1 * inv_det;
+    b2 = e2 * inv_det;
+    return true;
+}
+
+bool
+triangle_mesh::hit(const ray& r, float t_min, float t_max, hit_record& rec) const
+{
+    watertight_ray wr(r);
+    uint32_t closest = 0;
+    float closest_t = 0.0f;
+    float b1 = 0.0f;
+    float b2 = 0.0f;
+    bool found = traverse<false>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        if (!intersect_triangle(wr, i, t_min, t_max, closest_t, b1, b2))
+            return false;
+        t_max = closest_t;
+        closest = i;
+        return true;
+    });
+    if (!found)
+        return false;
+
+    // the shading data is only worked out for the closest triangle
+    const uint32_t* v = &geometry.indices[3 * size_t(closest)];
+    auto p0 = position(v[0]);
+    vec3 geometric = cross(position(v[1]) - p0, position(v[2]) - p0);
+    rec.t = closest_t;
+    rec.p = r.at(closest_t);
+    rec.set_face_normal(r, geometric / std::sqrt(dot(geometric, geometric)));
+
+    float b0 = 1.0f - b1 - b2;
+    if (geometry.has_normals()) {
+        vec3 shading(b0 * geometry.nx[v[0]] + b1 * geometry.nx[v[1]] + b2 * geometry.nx[v[2]],
+                     b0 * geometry.ny[v[0]] + b1 * geometry.ny[v[1]] + b2 * geometry.ny[v[2]],
+                     b0 * geometry.nz[v[0]] + b1 * geometry.nz[v[1]] + b2 * geometry.nz[v[2]]);
+        float length_squared = dot(shading, shading);
+        // turned to the side of the surface the ray is on, like the geometric normal
+        if (length_squared > 0.0f) {
+            shading /= std::sqrt(length_squared);
+            rec.normal = dot(shading, rec.normal) < 0.0f ? -shading : shading;
+        }
+    }
+    if (geometry.has_uvs()) {
+        rec.u = b0 * geometry.u[v[0]] + b1 * geometry.u[v[1]] + b2 * geometry.u[v[2]];
+        rec.v = b0 * geometry.v[v[0]] + b1 * geometry.v[v[1]] + b2 * geometry.v[v[2]];
+    } else {
+        rec.u = b1;
+        rec.v = b2;
+    }
+    rec.mat_id = mat_id;
+    return true;
+}
+
+bool
+triangle_mesh::intersect_t(const ray& r, float t_min, float t_max, float& t) const
+{
+    watertight_ray wr(r);
+    return traverse<false>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        float b1, b2;
+        if (!intersect_triangle(wr, i, t_min, t_max, t, b1, b2))
+            return false;
+        t_max = t;
+        return true;
+    });
+}
+
+bool
+triangle_mesh::occluded(const ray& r, float t_min, float t_max) const
+{
+    watertight_ray wr(r);
+    return traverse<true>(r, t_min, t_max, [&](uint32_t i, float t_min, float& t_max) {
+        float t, b1, b2;
+        return intersect_triangle(wr, i, t_min, t_max, t, b1, b2);
+    });
+}
+
+bool
+triangle_mesh::bounding_box(float time0, float time1, aabb& output_box) const
+{
+    if (geometry.indices.empty())
+        return false;
+
+    output_box = box;
+    return true;
+}
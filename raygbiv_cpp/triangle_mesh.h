@@ -0,0 +1,122 @@
+#pragma once
+
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bvh_node.h"
+
+// The vertex and index buffers of a mesh, one array per coordinate. Normals and uvs are either empty or hold one
+// entry per vertex.
+struct mesh_buffers
+{
+    std::vector<float> x, y, z;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> u, v;
+    // three vertices per triangle, counter-clockwise seen from the outside
+    std::vector<uint32_t> indices;
+
+    size_t vertex_count() const { return x.size(); }
+    size_t triangle_count() const { return indices.size() / 3; }
+    bool has_normals() const { return !nx.empty(); }
+    bool has_uvs() const { return !u.empty(); }
+};
+
+// The same arrays as read by the intersection code, which may be those of a mesh_buffers or those of a mesh mapped
+// from a cache file.
+struct mesh_view
+{
+    mesh_view() {}
+    mesh_view(const mesh_buffers& m)
+      : x(m.x)
+      , y(m.y)
+      , z(m.z)
+      , nx(m.nx)
+      , ny(m.ny)
+      , nz(m.nz)
+      , u(m.u)
+      , v(m.v)
+      , indices(m.indices)
+    {}
+
+    array_view<float> x, y, z;
+    array_view<float> nx, ny, nz;
+    array_view<float> u, v;
+    array_view<uint32_t> indices;
+
+    size_t vertex_count() const { return x.size; }
+    size_t triangle_count() const { return indices.size / 3; }
+    bool has_normals() const { return !nx.empty(); }
+    bool has_uvs() const { return !u.empty(); }
+};
+
+class mapped_file;
+
+// An indexed triangle mesh with a tree of its own over its triangles. The index buffer is put in the order the leaves
+// of the tree refer to the triangles, so a leaf is a range of it and nothing else is needed to find them. Rays are
+// intersected with the watertight test of Woop, Benthin and Wald, so that rays through a shared edge or vertex never
+// slip between the triangles around it.
+class triangle_mesh : public bvh_node
+{
+  public:
+    triangle_mesh(mesh_buffers buffers, uint32_t mat_id, const bvh_build_options& options = bvh_build_options());
+
+    // A mesh whose arrays, and tree, are in a file mapped into memory, which it keeps mapped. The tree is set up by
+    // the caller, through mapped_nodes, box and stats.
+    triangle_mesh(shared_ptr<const mapped_file> file, const mesh_view& geometry, uint32_t mat_id);
+
+    virtual bool hit(const ray& r, float t_min, float t_max, hit_record& rec) const override;
+
+    virtual bool intersect_t(const ray& r, float t_min, float t_max, float& t) const override;
+
+    virtual bool occluded(const ray& r, float t_min, float t_max) const override;
+
+    // its tree holds triangles rather than the objects bvh_node's packet traversal expects, so the lanes are traced
+    // one at a time
+    virtual void intersect_packet(ray_packet& packet, uint32_t lanes) const override
+    {
+        hittable::intersect_packet(packet, lanes);
+    }
+
+    virtual bool bounding_box(float time0, float time1, aabb& output_box) const override;
+
+  public:
+    // the arrays the mesh was built from; empty if it was mapped from a file
+    mesh_buffers mesh;
+    // what the intersection reads: the arrays of mesh, or those in the mapped file
+    mesh_view geometry;
+    uint32_t mat_id;
+
+  private:
+    // what the watertight test needs of a ray, worked out once for all the triangles it is tested against
+    struct watertight_ray
+    {
+        watertight_ray(const ray& r);
+
+        point3 origin;
+        // the axes permuted so that kz is the one the direction is largest along
+        int kx, ky, kz;
+        // shear taking the direction to the z axis
+        float sx, sy, sz;
+    };
+
+    // the closest hit of r on triangle i in (t_min, t_max), and the weights of its second and third vertices there
+    bool intersect_triangle(const watertight_ray& r,
+                            uint32_t i,
+                            float t_min,
+                            float t_max,
+                            float& t,
+                            float& b1,
+                            float& b2) const;
+
+    vec3 position(uint32_t vertex) const
+    {
+        return vec3(geometry.x[vertex], geometry.y[vertex], geometry.z[vertex]);
+    }
+
+    shared_ptr<const mapped_file> file;
+};
+
+#endif
@@ -10,6 +10,7 @@
 
 using std::sqrt;
 
+using glm::vec2;
 using glm::vec3;
 // class vec3
 // {
@@ -143,11 +144,27 @@ unit_vector(vec3 v)
     return v / v.length();
 }
 
+// the components are drawn one statement at a time so that every compiler draws them in the same order
+inline vec3
+random_vec3(const vec3& min, const vec3& max)
+{
+    auto x = random_float(min.x, max.x);
+    auto y = random_float(min.y, max.y);
+    auto z = random_float(min.z, max.z);
+    return vec3(x, y, z);
+}
+
+inline vec3
+random_vec3(float min, float max)
+{
+    return random_vec3(vec3(min, min, min), vec3(max, max, max));
+}
+
 inline vec3
 random_in_unit_sphere()
 {
     while (true) {
-        auto p = glm::linearRand(vec3(-1,-1,-1), vec3(1,1,1));//vec3::random(-1.0f, 1.0f);
+        auto p = random_vec3(-1.0f, 1.0f);
         if (glm::length2(p) >= 1.0f)
             continue;
         return p;
@@ -170,11 +187,34 @@ random_in_hemisphere(const vec3& normal)
         return -in_unit_sphere;
 }
 
+// maps a point of the unit square onto the unit disk, keeping areas in proportion (Shirley and Chiu's concentric
+// mapping), so that well spread samples of the square stay well spread on the disk
+inline vec3
+random_in_unit_disk(const vec2& u)
+{
+    auto a = 2.0f * u.x - 1.0f;
+    auto b = 2.0f * u.y - 1.0f;
+    if (a == 0.0f && b == 0.0f)
+        return vec3(0.0f, 0.0f, 0.0f);
+
+    float r, theta;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        theta = (pi / 4.0f) * (b / a);
+    } else {
+        r = b;
+        theta = (pi / 2.0f) - (pi / 4.0f) * (a / b);
+    }
+    return vec3(r * cos(theta), r * sin(theta), 0.0f);
+}
+
 inline vec3
 random_in_unit_disk()
 {
     while (true) {
-        auto p = vec3(random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), 0.0f);
+        auto x = random_float(-1.0f, 1.0f);
+        auto y = random_float(-1.0f, 1.0f);
+        auto p = vec3(x, y, 0.0f);
         if (glm::length2(p) >= 1.0f)
             continue;
         return p;
@@ -197,10 +237,10 @@ refract(const vec3& uv, const vec3& n, float etai_over_etat)
 }
 
 inline vec3
-random_cosine_direction()
+random_cosine_direction(const vec2& u)
 {
-    auto r1 = random_float();
-    auto r2 = random_float();
+    auto r1 = u.x;
+    auto r2 = u.y;
     auto z = sqrt(1 - r2);
 
     auto phi = 2 * pi * r1;
@@ -211,10 +251,10 @@ random_cosine_direction()
 }
 
 inline vec3
-random_to_sphere(float radius, float distance_squared)
+random_to_sphere(float radius, float distance_squared, const vec2& u)
 {
-    auto r1 = random_float();
-    auto r2 = random_float();
+    auto r1 = u.x;
+    auto r2 = u.y;
     auto z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
 
     auto phi = 2 * pi * r1;